@@ -0,0 +1,422 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "governor.h"
+#include "token.h"
+
+// ---------- Arrays ----------
+
+class ArrayHeap;
+
+// A fixed-size array of numbers. Header and elements are one allocation:
+// the header fills the first cache line and the elements start on the
+// next, so they are aligned for any vector width the kernels use.
+class Array
+{
+public:
+    static constexpr size_t ALIGNMENT = 64;
+
+    // Largest array a script may create (8 GiB of elements)
+    static constexpr size_t MAX_SIZE = size_t(1) << 30;
+
+    size_t Size() const
+    {
+        return size;
+    }
+
+    double* Data()
+    {
+        return reinterpret_cast<double*>(reinterpret_cast<char*>(this) + ALIGNMENT);
+    }
+
+    const double* Data() const
+    {
+        return reinterpret_cast<const double*>(reinterpret_cast<const char*>(this) + ALIGNMENT);
+    }
+
+    // Operators allocate their result next to their operands
+    ArrayHeap& Heap() const
+    {
+        return *heap;
+    }
+
+private:
+    friend class ArrayHeap;
+
+    Array(ArrayHeap& h, size_t n)
+        : heap(&h), size(n)
+    {
+    }
+
+    ArrayHeap* heap;
+    size_t size;
+};
+
+static_assert(sizeof(Array) <= Array::ALIGNMENT, "Array header must fit in one cache line");
+
+// Owns every array a program creates. Like strings, arrays live until the
+// end of the run; there is no loop that could create them without bound.
+class ArrayHeap
+{
+private:
+    std::vector<Array*> arrays;
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor; // charged for every array
+
+public:
+    ArrayHeap()
+        : governor(ownGovernor)
+    {
+    }
+
+    explicit ArrayHeap(ResourceGovernor& g)
+        : governor(g)
+    {
+    }
+
+    ArrayHeap(const ArrayHeap&) = delete;
+    ArrayHeap& operator=(const ArrayHeap&) = delete;
+
+    ~ArrayHeap()
+    {
+        for (Array* array : arrays)
+            ::operator delete(array, std::align_val_t(Array::ALIGNMENT));
+    }
+
+    // Elements are left uninitialized
+    Array& Allocate(size_t n)
+    {
+        if (n > Array::MAX_SIZE)
+            throw std::runtime_error("Array too large: " + std::to_string(n) + " elements");
+
+        size_t bytes = Array::ALIGNMENT + n * sizeof(double);
+        governor.Charge(bytes);
+
+        arrays.reserve(arrays.size() + 1); // push_back below cannot throw
+        void* memory = ::operator new(bytes, std::align_val_t(Array::ALIGNMENT));
+        Array* array = new (memory) Array(*this, n);
+        arrays.push_back(array);
+        return *array;
+    }
+};
+
+// ---------- Kernels ----------
+//
+// Loops over whole arrays, written once with GCC vector types for a given
+// number of double lanes. Lanes = 2 is SSE2, which every x86-64 has; the
+// Avx2 wrappers below compile the same loops with 4 lanes for CPUs that
+// support it, and ArrayKernels::Get() picks one of the two at startup.
+//
+// Element-wise results are exact IEEE operations, so they do not depend on
+// the set. Reductions keep REDUCE_LANES partial results, element i going
+// to lane i % REDUCE_LANES, and combine them in a fixed order: sum, min
+// and max are the same on every CPU, though sum may differ in the last
+// bits from adding the elements one by one.
+
+// Which operand of an element-wise operator is a plain number
+enum class ArrayShape : uint8_t
+{
+    ARRAYS,
+    RIGHT_NUMBER,
+    LEFT_NUMBER,
+};
+
+inline constexpr size_t REDUCE_LANES = 8;
+
+// GCC vector types of 2 and 4 doubles, and the masks their comparisons give
+template <size_t LANES>
+struct Lanes;
+
+template <>
+struct Lanes<2>
+{
+    typedef double Vector __attribute__((vector_size(16)));
+    typedef int64_t Mask __attribute__((vector_size(16)));
+};
+
+template <>
+struct Lanes<4>
+{
+    typedef double Vector __attribute__((vector_size(32)));
+    typedef int64_t Mask __attribute__((vector_size(32)));
+};
+
+// out[i] = left[i] OP right[i], reading a number operand as if repeated
+template <size_t LANES, TokenType OP, ArrayShape SHAPE>
+inline void MapKernel(const double* left, const double* right, double* out, size_t n)
+{
+    using Vector = typename Lanes<LANES>::Vector;
+    using Left = std::conditional_t<SHAPE == ArrayShape::LEFT_NUMBER, double, Vector>;
+    using Right = std::conditional_t<SHAPE == ArrayShape::RIGHT_NUMBER, double, Vector>;
+
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES)
+    {
+        Left a;
+        Right b;
+        std::memcpy(&a, SHAPE == ArrayShape::LEFT_NUMBER ? left : left + i, sizeof(a));
+        std::memcpy(&b, SHAPE == ArrayShape::RIGHT_NUMBER ? right : right + i, sizeof(b));
+
+        Vector r;
+        if constexpr (OP == TokenType::PLUS)
+            r = a + b;
+        else if constexpr (OP == TokenType::MINUS)
+            r = a - b;
+        else if constexpr (OP == TokenType::STAR)
+            r = a * b;
+        else
+            r = a / b;
+        std::memcpy(out + i, &r, sizeof(r));
+    }
+
+    for (; i < n; ++i)
+    {
+        double a = SHAPE == ArrayShape::LEFT_NUMBER ? *left : left[i];
+        double b = SHAPE == ArrayShape::RIGHT_NUMBER ? *right : right[i];
+        if constexpr (OP == TokenType::PLUS)
+            out[i] = a + b;
+        else if constexpr (OP == TokenType::MINUS)
+            out[i] = a - b;
+        else if constexpr (OP == TokenType::STAR)
+            out[i] = a * b;
+        else
+            out[i] = a / b;
+    }
+}
+
+template <size_t LANES>
+inline void NegateKernel(const double* in, double* out, size_t n)
+{
+    using Vector = typename Lanes<LANES>::Vector;
+
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES)
+    {
+        Vector a;
+        std::memcpy(&a, in + i, sizeof(a));
+        a = -a;
+        std::memcpy(out + i, &a, sizeof(a));
+    }
+
+    for (; i < n; ++i)
+        out[i] = -in[i];
+}
+
+template <size_t LANES>
+inline double SumKernel(const double* data, size_t n)
+{
+    using Vector = typename Lanes<LANES>::Vector;
+    constexpr size_t VECTORS = REDUCE_LANES / LANES;
+
+    Vector partial[VECTORS] = {};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES)
+    {
+        // Unrolled, so the partial results stay in registers
+#pragma GCC unroll 4
+        for (size_t k = 0; k < VECTORS; ++k)
+        {
+            Vector x;
+            std::memcpy(&x, data + i + k * LANES, sizeof(x));
+            partial[k] += x;
+        }
+    }
+
+    double lanes[REDUCE_LANES];
+    std::memcpy(lanes, partial, sizeof(lanes));
+    for (; i < n; ++i)
+        lanes[i % REDUCE_LANES] += data[i];
+
+    for (size_t width = REDUCE_LANES / 2; width > 0; width /= 2)
+        for (size_t k = 0; k < width; ++k)
+            lanes[k] += lanes[k + width];
+    return lanes[0];
+}
+
+// min or max of a non-empty array; NaN if any element is NaN
+template <size_t LANES, bool MAX>
+inline double ExtremeKernel(const double* data, size_t n)
+{
+    using Vector = typename Lanes<LANES>::Vector;
+    using Mask = typename Lanes<LANES>::Mask;
+    constexpr size_t VECTORS = REDUCE_LANES / LANES;
+
+    Vector best[VECTORS];
+    for (Vector& v : best)
+        for (size_t j = 0; j < LANES; ++j)
+            v[j] = data[0];
+
+    Mask nan = {};
+    size_t i = 0;
+    for (; i + REDUCE_LANES <= n; i += REDUCE_LANES)
+    {
+#pragma GCC unroll 4
+        for (size_t k = 0; k < VECTORS; ++k)
+        {
+            Vector x;
+            std::memcpy(&x, data + i + k * LANES, sizeof(x));
+            if constexpr (MAX)
+                best[k] = x > best[k] ? x : best[k];
+            else
+                best[k] = x < best[k] ? x : best[k];
+            nan |= x != x;
+        }
+    }
+
+    double lanes[REDUCE_LANES];
+    std::memcpy(lanes, best, sizeof(lanes));
+    bool anyNan = false;
+    for (size_t j = 0; j < LANES; ++j)
+        anyNan |= nan[j] != 0;
+
+    auto better = [](double x, double y) { return MAX ? x > y : x < y; };
+    for (; i < n; ++i)
+    {
+        double x = data[i];
+        double& lane = lanes[i % REDUCE_LANES];
+        lane = better(x, lane) ? x : lane;
+        anyNan |= x != x;
+    }
+
+    if (anyNan || data[0] != data[0])
+        return std::numeric_limits<double>::quiet_NaN();
+
+    for (size_t width = REDUCE_LANES / 2; width > 0; width /= 2)
+        for (size_t k = 0; k < width; ++k)
+            lanes[k] = better(lanes[k + width], lanes[k]) ? lanes[k + width] : lanes[k];
+    return lanes[0];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// The same loops compiled for AVX2. 'flatten' inlines them here, so they
+// are built with this function's instruction set (only when optimizing).
+template <TokenType OP, ArrayShape SHAPE>
+__attribute__((target("avx2"), flatten))
+void MapAvx2(const double* left, const double* right, double* out, size_t n)
+{
+    MapKernel<4, OP, SHAPE>(left, right, out, n);
+}
+
+__attribute__((target("avx2"), flatten))
+inline void NegateAvx2(const double* in, double* out, size_t n)
+{
+    NegateKernel<4>(in, out, n);
+}
+
+__attribute__((target("avx2"), flatten))
+inline double SumAvx2(const double* data, size_t n)
+{
+    return SumKernel<4>(data, n);
+}
+
+template <bool MAX>
+__attribute__((target("avx2"), flatten))
+double ExtremeAvx2(const double* data, size_t n)
+{
+    return ExtremeKernel<4, MAX>(data, n);
+}
+#endif
+
+// One instruction set's kernels, selected once per process
+struct ArrayKernels
+{
+    using Map = void (*)(const double*, const double*, double*, size_t);
+    using Reduce = double (*)(const double*, size_t);
+
+    const char* name;
+    Map map[4][3]; // [PLUS, MINUS, STAR, SLASH][ArrayShape]
+    void (*negate)(const double*, double*, size_t);
+    Reduce sum;
+    Reduce min;
+    Reduce max;
+
+    // Two lanes: SSE2 on x86-64, plain 128-bit vectors elsewhere
+    static ArrayKernels Baseline()
+    {
+        ArrayKernels k{"sse2", {}, NegateKernel<2>, SumKernel<2>,
+                       ExtremeKernel<2, false>, ExtremeKernel<2, true>};
+        FillRow<TokenType::PLUS>(k, MapKernel<2, TokenType::PLUS, ArrayShape::ARRAYS>,
+                                 MapKernel<2, TokenType::PLUS, ArrayShape::RIGHT_NUMBER>,
+                                 MapKernel<2, TokenType::PLUS, ArrayShape::LEFT_NUMBER>);
+        FillRow<TokenType::MINUS>(k, MapKernel<2, TokenType::MINUS, ArrayShape::ARRAYS>,
+                                  MapKernel<2, TokenType::MINUS, ArrayShape::RIGHT_NUMBER>,
+                                  MapKernel<2, TokenType::MINUS, ArrayShape::LEFT_NUMBER>);
+        FillRow<TokenType::STAR>(k, MapKernel<2, TokenType::STAR, ArrayShape::ARRAYS>,
+                                 MapKernel<2, TokenType::STAR, ArrayShape::RIGHT_NUMBER>,
+                                 MapKernel<2, TokenType::STAR, ArrayShape::LEFT_NUMBER>);
+        FillRow<TokenType::SLASH>(k, MapKernel<2, TokenType::SLASH, ArrayShape::ARRAYS>,
+                                  MapKernel<2, TokenType::SLASH, ArrayShape::RIGHT_NUMBER>,
+                                  MapKernel<2, TokenType::SLASH, ArrayShape::LEFT_NUMBER>);
+        return k;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    static ArrayKernels Avx2()
+    {
+        ArrayKernels k{"avx2", {}, NegateAvx2, SumAvx2, ExtremeAvx2<false>, ExtremeAvx2<true>};
+        FillRow<TokenType::PLUS>(k, MapAvx2<TokenType::PLUS, ArrayShape::ARRAYS>,
+                                 MapAvx2<TokenType::PLUS, ArrayShape::RIGHT_NUMBER>,
+                                 MapAvx2<TokenType::PLUS, ArrayShape::LEFT_NUMBER>);
+        FillRow<TokenType::MINUS>(k, MapAvx2<TokenType::MINUS, ArrayShape::ARRAYS>,
+                                  MapAvx2<TokenType::MINUS, ArrayShape::RIGHT_NUMBER>,
+                                  MapAvx2<TokenType::MINUS, ArrayShape::LEFT_NUMBER>);
+        FillRow<TokenType::STAR>(k, MapAvx2<TokenType::STAR, ArrayShape::ARRAYS>,
+                                 MapAvx2<TokenType::STAR, ArrayShape::RIGHT_NUMBER>,
+                                 MapAvx2<TokenType::STAR, ArrayShape::LEFT_NUMBER>);
+        FillRow<TokenType::SLASH>(k, MapAvx2<TokenType::SLASH, ArrayShape::ARRAYS>,
+                                  MapAvx2<TokenType::SLASH, ArrayShape::RIGHT_NUMBER>,
+                                  MapAvx2<TokenType::SLASH, ArrayShape::LEFT_NUMBER>);
+        return k;
+    }
+#endif
+
+    // The widest set this CPU supports
+    static const ArrayKernels& Get()
+    {
+        static const ArrayKernels best = Select();
+        return best;
+    }
+
+    // Row of 'map' for an element-wise operator
+    static constexpr size_t Row(TokenType op)
+    {
+        switch (op)
+        {
+        case TokenType::PLUS:  return 0;
+        case TokenType::MINUS: return 1;
+        case TokenType::STAR:  return 2;
+        case TokenType::SLASH: return 3;
+        default:
+            throw std::logic_error("Not an element-wise operator");
+        }
+    }
+
+private:
+    template <TokenType OP>
+    static void FillRow(ArrayKernels& k, Map arrays, Map rightNumber, Map leftNumber)
+    {
+        Map* row = k.map[Row(OP)];
+        row[static_cast<size_t>(ArrayShape::ARRAYS)] = arrays;
+        row[static_cast<size_t>(ArrayShape::RIGHT_NUMBER)] = rightNumber;
+        row[static_cast<size_t>(ArrayShape::LEFT_NUMBER)] = leftNumber;
+    }
+
+    static ArrayKernels Select()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2"))
+            return Avx2();
+#endif
+        return Baseline();
+    }
+};
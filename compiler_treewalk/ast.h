@@ -1,81 +1,349 @@
 #pragma once
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <memory>
+#include <type_traits>
+#include <typeinfo>
 #include <vector>
 
+#include "token.h"
+
+// Every node is constexpr so scripts can be parsed during constant
+// evaluation (see compiletime.h). Leaf nodes spell out their destructors:
+// GCC 12 cannot call an implicit virtual destructor there.
+
+// Thrown when a program uses something an execution tier cannot handle.
+// Nothing has run yet at that point, so the caller can fall back to the
+// tree-walk Interpreter.
+struct UnsupportedProgram : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// dynamic_cast on a node allocated during constant evaluation fails in
+// GCC 12 even when the type matches. No node type has subclasses, so
+// comparing the dynamic type is equivalent there; code that must also run
+// at compile time dispatches with this. At run time it stays dynamic_cast,
+// since a type_info mismatch can cost a string comparison.
+template <typename T, typename Base>
+constexpr T* NodeCast(Base* node)
+{
+    if (std::is_constant_evaluated())
+        return typeid(*node) == typeid(T) ? static_cast<T*>(node) : nullptr;
+    return dynamic_cast<T*>(node);
+}
+
+template <typename T, typename Base>
+constexpr const T* NodeCast(const Base* node)
+{
+    if (std::is_constant_evaluated())
+        return typeid(*node) == typeid(T) ? static_cast<const T*>(node) : nullptr;
+    return dynamic_cast<const T*>(node);
+}
+
+// Where a variable lives at run time, decided by the Resolver
+// (resolver.h). Top-level code looks names up through the block scopes;
+// function bodies keep parameters and locals in numbered slots of their
+// call frame and see only globals beyond that.
+struct NameRef
+{
+    enum Kind : uint8_t { SCOPES, GLOBAL, SLOT };
+
+    Kind kind = SCOPES;
+    uint32_t slot = 0; // SLOT: index in the current call frame
+};
+
+struct FunctionStmt;
+
+// Functions every script can call without declaring them (see Resolver)
+enum class Builtin : uint8_t
+{
+    NONE, // a declared function
+    ARRAY,
+    RANGE,
+    LEN,
+    SUM,
+    MIN,
+    MAX,
+};
+
 // ---------- Expressions ----------
 
 struct Expr
 {
-    virtual ~Expr() = default;
+    constexpr virtual ~Expr() = default;
+
+    // Moves owned subexpressions into 'out' (see DestroyChildren)
+    constexpr virtual void Detach(std::vector<std::unique_ptr<Expr>>& /*out*/) {}
 };
 
+// The default destructors would recurse once per level of a deep operand
+// chain. Nodes with children call this instead: the subtree is detached
+// onto a heap stack, so every node is destroyed with null children.
+constexpr void DestroyChildren(Expr& expr)
+{
+    std::vector<std::unique_ptr<Expr>> pending;
+    expr.Detach(pending);
+
+    while (!pending.empty())
+    {
+        std::unique_ptr<Expr> next = std::move(pending.back());
+        pending.pop_back();
+        next->Detach(pending);
+    }
+}
+
 struct NumberExpr : Expr
 {
     double value;
-    explicit NumberExpr(double v) : value(v) {}
+    constexpr explicit NumberExpr(double v) : value(v) {}
+    constexpr ~NumberExpr() override {}
+};
+
+struct StringExpr : Expr
+{
+    std::string value;
+    constexpr explicit StringExpr(const std::string& v) : value(v) {}
+    constexpr ~StringExpr() override {}
 };
 
 struct VariableExpr : Expr
 {
     std::string name;
-    explicit VariableExpr(const std::string& n) : name(n) {}
+    NameRef ref;
+    constexpr explicit VariableExpr(const std::string& n) : name(n) {}
+    constexpr ~VariableExpr() override {}
+};
+
+struct UnaryExpr : Expr
+{
+    TokenType op;
+    std::unique_ptr<Expr> operand;
+
+    constexpr UnaryExpr(TokenType o, std::unique_ptr<Expr> e)
+        : op(o), operand(std::move(e)) {}
+
+    constexpr ~UnaryExpr() override { DestroyChildren(*this); }
+
+    constexpr void Detach(std::vector<std::unique_ptr<Expr>>& out) override
+    {
+        if (operand)
+            out.push_back(std::move(operand));
+    }
 };
 
 struct BinaryExpr : Expr
 {
-    char op;
+    TokenType op;
     std::unique_ptr<Expr> left;
     std::unique_ptr<Expr> right;
 
-    BinaryExpr(char o,
+    constexpr BinaryExpr(TokenType o,
                std::unique_ptr<Expr> l,
                std::unique_ptr<Expr> r)
         : op(o), left(std::move(l)), right(std::move(r)) {}
+
+    constexpr ~BinaryExpr() override { DestroyChildren(*this); }
+
+    constexpr void Detach(std::vector<std::unique_ptr<Expr>>& out) override
+    {
+        if (left)
+            out.push_back(std::move(left));
+        if (right)
+            out.push_back(std::move(right));
+    }
+};
+
+// name(args). The Resolver links 'function', or 'builtin' when name is
+// not declared, and, for small leaf functions, copies the returned
+// expression into 'inlined'.
+struct CallExpr : Expr
+{
+    std::string callee;
+    std::vector<std::unique_ptr<Expr>> args;
+    const FunctionStmt* function = nullptr;
+    Builtin builtin = Builtin::NONE;
+    std::unique_ptr<Expr> inlined; // refers to the arguments as slots 0..n-1
+
+    constexpr CallExpr(const std::string& c, std::vector<std::unique_ptr<Expr>> a)
+        : callee(c), args(std::move(a)) {}
+
+    constexpr ~CallExpr() override { DestroyChildren(*this); }
+
+    constexpr void Detach(std::vector<std::unique_ptr<Expr>>& out) override
+    {
+        for (auto& arg : args)
+            if (arg)
+                out.push_back(std::move(arg));
+        if (inlined)
+            out.push_back(std::move(inlined));
+    }
+};
+
+// [a, b, c]
+struct ArrayExpr : Expr
+{
+    std::vector<std::unique_ptr<Expr>> elements;
+
+    constexpr explicit ArrayExpr(std::vector<std::unique_ptr<Expr>> e)
+        : elements(std::move(e)) {}
+
+    constexpr ~ArrayExpr() override { DestroyChildren(*this); }
+
+    constexpr void Detach(std::vector<std::unique_ptr<Expr>>& out) override
+    {
+        for (auto& element : elements)
+            if (element)
+                out.push_back(std::move(element));
+    }
+};
+
+// name[index]; 'array' is always a VariableExpr
+struct IndexExpr : Expr
+{
+    std::unique_ptr<Expr> array;
+    std::unique_ptr<Expr> index;
+
+    constexpr IndexExpr(std::unique_ptr<Expr> a, std::unique_ptr<Expr> i)
+        : array(std::move(a)), index(std::move(i)) {}
+
+    constexpr ~IndexExpr() override { DestroyChildren(*this); }
+
+    constexpr void Detach(std::vector<std::unique_ptr<Expr>>& out) override
+    {
+        if (array)
+            out.push_back(std::move(array));
+        if (index)
+            out.push_back(std::move(index));
+    }
 };
 
 // ---------- Statements ----------
 
 struct Stmt
 {
-    virtual ~Stmt() = default;
+    constexpr virtual ~Stmt() = default;
 };
 
 struct AssignStmt : Stmt
 {
     std::string name;
+    NameRef ref;
     std::unique_ptr<Expr> value;
 
-    AssignStmt(const std::string& n, std::unique_ptr<Expr> v)
+    constexpr AssignStmt(const std::string& n, std::unique_ptr<Expr> v)
         : name(n), value(std::move(v)) {}
+
+    constexpr ~AssignStmt() override {}
 };
 
 struct PrintStmt : Stmt
 {
     std::unique_ptr<Expr> value;
 
-    explicit PrintStmt(std::unique_ptr<Expr> v)
+    constexpr explicit PrintStmt(std::unique_ptr<Expr> v)
         : value(std::move(v)) {}
+
+    constexpr ~PrintStmt() override {}
 };
 
 struct BlockStmt : Stmt
 {
   std::vector<std::unique_ptr<Stmt>> statements;
-  BlockStmt(std::vector<std::unique_ptr<Stmt>> stmts)
+  constexpr BlockStmt(std::vector<std::unique_ptr<Stmt>> stmts)
         : statements(std::move(stmts))
     {
     }
+
+  // Same idea as DestroyChildren: nested blocks are torn down from a heap
+  // stack rather than through recursive unique_ptr destructors.
+  constexpr ~BlockStmt() override
+  {
+      std::vector<std::unique_ptr<Stmt>> pending;
+      Detach(pending);
+
+      while (!pending.empty())
+      {
+          std::unique_ptr<Stmt> stmt = std::move(pending.back());
+          pending.pop_back();
+
+          if (auto block = NodeCast<BlockStmt>(stmt.get()))
+              block->Detach(pending);
+      }
+  }
+
+private:
+  constexpr void Detach(std::vector<std::unique_ptr<Stmt>>& pending)
+  {
+      for (auto& s : statements)
+          if (NodeCast<BlockStmt>(s.get()))
+              pending.push_back(std::move(s));
+  }
 };
 
 struct VarDeclStmt : Stmt
 {
   std::string name;
+  NameRef ref;
   std::unique_ptr<Expr> initializer;
   
-  VarDeclStmt(const std::string& n, std::unique_ptr<Expr> init)
+  constexpr VarDeclStmt(const std::string& n, std::unique_ptr<Expr> init)
         : name(n), initializer(std::move(init))
   {
   }
 
+  constexpr ~VarDeclStmt() override {}
+
+};
+
+// name[index] = value. Stores into the array the variable refers to; the
+// variable itself keeps referring to the same array.
+struct IndexAssignStmt : Stmt
+{
+    std::unique_ptr<Expr> array; // a VariableExpr
+    std::unique_ptr<Expr> index;
+    std::unique_ptr<Expr> value;
+
+    constexpr IndexAssignStmt(std::unique_ptr<Expr> a, std::unique_ptr<Expr> i,
+                              std::unique_ptr<Expr> v)
+        : array(std::move(a)), index(std::move(i)), value(std::move(v)) {}
+
+    constexpr ~IndexAssignStmt() override {}
+};
+
+// A call whose value is not used
+struct ExprStmt : Stmt
+{
+    std::unique_ptr<Expr> expr;
+
+    constexpr explicit ExprStmt(std::unique_ptr<Expr> e)
+        : expr(std::move(e)) {}
+
+    constexpr ~ExprStmt() override {}
 };
 
+struct ReturnStmt : Stmt
+{
+    std::unique_ptr<Expr> value;
+
+    constexpr explicit ReturnStmt(std::unique_ptr<Expr> v)
+        : value(std::move(v)) {}
+
+    constexpr ~ReturnStmt() override {}
+};
+
+// fn name(params) { body }, only at top level
+struct FunctionStmt : Stmt
+{
+    std::string name;
+    std::vector<std::string> params;
+    std::vector<std::unique_ptr<Stmt>> body;
+    uint32_t slots = 0; // frame size: parameters plus the most locals alive at once
+
+    constexpr FunctionStmt(const std::string& n, std::vector<std::string> p,
+                           std::vector<std::unique_ptr<Stmt>> b)
+        : name(n), params(std::move(p)), body(std::move(b)) {}
+
+    constexpr ~FunctionStmt() override {}
+};
@@ -0,0 +1,378 @@
+// Micro-benchmarks for the interpreter.
+//
+//   make bench
+//
+// Scripts are generated in memory so the numbers do not depend on files
+// lying around in the tree.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "lexer.h"
+#include "parser.h"
+#include "table_parser.h"
+#include "treewalk.h"
+#include "closure.h"
+#include "ir.h"
+#include "compiletime.h"
+#include "governor.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double Seconds(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+// Straight-line arithmetic over a growing set of globals.
+static std::string ArithmeticScript(int lines)
+{
+    std::string src = "var v0 = 1\n";
+    for (int i = 1; i < lines; ++i)
+    {
+        src += "var v" + std::to_string(i) + " = v" + std::to_string(i - 1) +
+               " * 3 + (v" + std::to_string(i / 2) + " - 7) / 2\n";
+    }
+    return src;
+}
+
+// Integer-only arithmetic kept small by the comparison, so the closure tier
+// can prove every expression integral.
+static std::string IntegerScript(int lines)
+{
+    std::string src = "var v0 = 1\n";
+    for (int i = 1; i < lines; ++i)
+    {
+        src += "var v" + std::to_string(i) + " = v" + std::to_string(i - 1) +
+               " * 3 - v" + std::to_string(i / 2) + " * 2 < " + std::to_string(i % 100) +
+               " + v" + std::to_string(i / 2) + "\n";
+    }
+    return src;
+}
+
+// ---------- Governor overhead ----------
+
+// Best of five tree-walk runs over the same program, in seconds. Every
+// limit is set, so each check the governor can make is live.
+static double TreeWalkSeconds(uint64_t* steps)
+{
+    std::string source = ArithmeticScript(200000); // tokens point into it
+    TokenStream tokens = Lexer(source).Tokenize();
+    auto program = Parser(tokens).ParseProgram();
+
+    ResourceGovernor::Limits limits;
+    limits.maxSteps = uint64_t(1) << 40;
+    limits.maxMemory = size_t(1) << 40;
+    limits.timeout = std::chrono::hours(1);
+
+    double best = 1e9;
+    for (int round = 0; round < 5; ++round)
+    {
+        ResourceGovernor governor(limits);
+        Interpreter interpreter(governor);
+
+        auto t0 = Clock::now();
+        interpreter.Execute(program);
+        best = std::min(best, Seconds(t0, Clock::now()));
+        *steps = governor.StepsUsed();
+    }
+    return best;
+}
+
+// The same run with the accounting compiled out, from the bench-ungoverned
+// build of this file ('make bench' builds both)
+static double UngovernedSeconds()
+{
+    FILE* child = popen("./bench-ungoverned --tree-walk", "r");
+    double seconds = 0;
+    if (!child)
+        return 0;
+    if (std::fscanf(child, "%lf", &seconds) != 1)
+        seconds = 0;
+    pclose(child);
+    return seconds;
+}
+
+static void BenchGovernor()
+{
+    uint64_t steps = 0;
+    double governed = TreeWalkSeconds(&steps);
+    double ungoverned = UngovernedSeconds();
+
+    if (ungoverned <= 0)
+    {
+        std::printf("governor: %.1f ms governed (no ./bench-ungoverned to compare)\n",
+                    governed * 1e3);
+        return;
+    }
+
+    std::printf("governor: %llu steps, tree walk %.1f ms governed, %.1f ms ungoverned "
+                "(%.1f%% overhead, %.2f ns/step)\n",
+                (unsigned long long)steps, governed * 1e3, ungoverned * 1e3,
+                100.0 * (governed - ungoverned) / ungoverned,
+                (governed - ungoverned) / steps * 1e9);
+}
+
+// ---------- Expression parsing ----------
+
+static void BenchParser()
+{
+    // Long mixed-precedence chains: the shape that used to cost one call
+    // per precedence level per operand.
+    std::string source;
+    for (int i = 0; i < 2000; ++i)
+    {
+        source += "print 1";
+        for (int j = 0; j < 200; ++j)
+            source += (j % 3 == 0) ? " + 2 * 3" : (j % 3 == 1) ? " - 4 / 5" : " < -6";
+        source += "\n";
+    }
+
+    Lexer lexer(source);
+    TokenStream tokens = lexer.Tokenize();
+
+    auto t0 = Clock::now();
+    Parser parser(tokens);
+    auto program = parser.ParseProgram();
+    auto t1 = Clock::now();
+
+    TableParser tableParser(tokens);
+    auto tableProgram = tableParser.ParseProgram();
+    auto t2 = Clock::now();
+
+    std::printf("parser: %zu tokens, %.2f ns/token Pratt, %.2f ns/token LL(1) tables\n",
+                tokens.Size(), Seconds(t0, t1) / tokens.Size() * 1e9,
+                Seconds(t1, t2) / tokens.Size() * 1e9);
+}
+
+// ---------- Execution tiers ----------
+
+static void BenchClosures(const char* name, const std::string& source)
+{
+    Lexer lexer(source);
+    TokenStream tokens = lexer.Tokenize();
+
+    Parser parser(tokens);
+    auto program = parser.ParseProgram();
+
+    auto t0 = Clock::now();
+    Interpreter interpreter;
+    interpreter.Execute(program);
+    auto t1 = Clock::now();
+
+    ClosureCompiler compiler;
+    compiler.Compile(program);
+    auto t2 = Clock::now();
+    compiler.Execute();
+    auto t3 = Clock::now();
+
+    // Compiling is part of the cost: every statement runs exactly once
+    std::printf("closures (%s): tree walk %.1f ms, compile %.1f ms + run %.1f ms "
+                "= %.1f ms (%.2fx end to end)\n",
+                name, Seconds(t0, t1) * 1e3, Seconds(t1, t2) * 1e3, Seconds(t2, t3) * 1e3,
+                Seconds(t1, t3) * 1e3, Seconds(t0, t1) / Seconds(t1, t3));
+}
+
+// ---------- SSA optimizer ----------
+
+// Generated-script shape: every line recomputes the same subexpressions
+// and most temporaries are never read.
+static std::string RedundantScript(int lines)
+{
+    std::string src = "var a = 3\nvar b = 4\n";
+    for (int i = 0; i < lines; ++i)
+    {
+        std::string t = "t" + std::to_string(i);
+        src += "var " + t + " = (a * b + 1) * (a * b + 1) - b\n";
+        if (i % 10 == 0)
+            src += "print " + t + " + a * b\n";
+    }
+    return src;
+}
+
+static void BenchIr()
+{
+    std::string source = RedundantScript(200000);
+
+    Lexer lexer(source);
+    TokenStream tokens = lexer.Tokenize();
+
+    Parser parser(tokens);
+    auto program = parser.ParseProgram();
+
+    // Printing dominates otherwise; only the execution cost is of interest
+    std::streambuf* saved = std::cout.rdbuf(nullptr);
+
+    auto t0 = Clock::now();
+    Interpreter interpreter;
+    interpreter.Execute(program);
+    auto t1 = Clock::now();
+
+    IrCompiler compiler;
+    compiler.Lower(program);
+    IrCompiler::Stats stats = compiler.Optimize();
+    auto t2 = Clock::now();
+    compiler.Execute();
+    auto t3 = Clock::now();
+
+    std::cout.rdbuf(saved);
+
+    std::printf("ir: tree walk %.1f ms, lower + optimize %.1f ms + run %.1f ms = %.1f ms "
+                "(%.2fx end to end; %zu common, %zu dead removed)\n",
+                Seconds(t0, t1) * 1e3, Seconds(t1, t2) * 1e3, Seconds(t2, t3) * 1e3,
+                Seconds(t1, t3) * 1e3, Seconds(t0, t1) / Seconds(t1, t3), stats.common, stats.dead);
+}
+
+// ---------- Function calls ----------
+
+static double RunScript(const std::string& source)
+{
+    TokenStream tokens = Lexer(source).Tokenize();
+    auto program = Parser(tokens).ParseProgram();
+
+    auto t0 = Clock::now();
+    Interpreter interpreter;
+    interpreter.Execute(program);
+    return Seconds(t0, Clock::now());
+}
+
+// The same update written out on every line, behind a call the resolver
+// inlines, and behind a call that needs a frame. Inlined calls still pay
+// for the call and its argument, so they land between the other two.
+static void BenchCalls()
+{
+    const int LINES = 200000;
+    std::string copied = "var acc = 1\n";
+    std::string inlined = "fn step(x) {\n    return x * 0.5 + 1\n}\nvar acc = 1\n";
+    std::string framed = "fn step(x) {\n    var half = x * 0.5\n    return half + 1\n}\nvar acc = 1\n";
+
+    for (int i = 0; i < LINES; ++i)
+    {
+        copied += "acc = acc * 0.5 + 1\n";
+        inlined += "acc = step(acc)\n";
+        framed += "acc = step(acc)\n";
+    }
+
+    std::printf("calls: written out %.1f ns, inlined %.1f ns, with frame %.1f ns per line\n",
+                RunScript(copied) * 1e9 / LINES, RunScript(inlined) * 1e9 / LINES,
+                RunScript(framed) * 1e9 / LINES);
+}
+
+// ---------- Arrays ----------
+
+// The same weighted sum written with one variable per element and with
+// arrays, then the kernels alone on an array that stays in L1
+static void BenchArrays()
+{
+    const int ELEMENTS = 100000;
+    std::string scalar = "var total = 0\n";
+    for (int i = 0; i < ELEMENTS; ++i)
+        scalar += "var x" + std::to_string(i) + " = " + std::to_string(i) + "\n";
+    for (int i = 0; i < ELEMENTS; ++i)
+        scalar += "total = total + x" + std::to_string(i) + " * 0.5 + 1\n";
+
+    std::string vector = "var x = range(" + std::to_string(ELEMENTS) + ")\n"
+                         "var total = sum(x * 0.5 + 1)\n";
+
+    std::printf("arrays: scalar script %.1f ms, array script %.3f ms per %d elements\n",
+                RunScript(scalar) * 1e3, RunScript(vector) * 1e3, ELEMENTS);
+
+    const size_t SIZE = 2048;
+    const int ROUNDS = 20000;
+    ArrayHeap heap;
+    Array& a = heap.Allocate(SIZE);
+    Array& out = heap.Allocate(SIZE);
+    for (size_t i = 0; i < SIZE; ++i)
+        a.Data()[i] = static_cast<double>(i) * 0.25;
+
+    auto measure = [&](const ArrayKernels& kernels)
+    {
+        double two = 2;
+        auto t0 = Clock::now();
+        for (int r = 0; r < ROUNDS; ++r)
+            kernels.map[ArrayKernels::Row(TokenType::STAR)][static_cast<size_t>(ArrayShape::RIGHT_NUMBER)](
+                a.Data(), &two, out.Data(), SIZE);
+        auto t1 = Clock::now();
+
+        volatile double sink = 0;
+        for (int r = 0; r < ROUNDS; ++r)
+            sink = sink + kernels.sum(out.Data(), SIZE);
+        auto t2 = Clock::now();
+
+        std::printf("  %s: a * 2 %.3f ns, sum %.3f ns per element\n", kernels.name,
+                    Seconds(t0, t1) * 1e9 / (double(SIZE) * ROUNDS),
+                    Seconds(t1, t2) * 1e9 / (double(SIZE) * ROUNDS));
+    };
+
+    // The kernels scripts use, and SSE2 if those are wider
+    measure(ArrayKernels::Get());
+    if (std::string(ArrayKernels::Get().name) != ArrayKernels::Baseline().name)
+        measure(ArrayKernels::Baseline());
+}
+
+// ---------- Compile-time scripts ----------
+
+// A small embedded script of the kind a service runs at startup
+#define EMBEDDED_SCRIPT                                                  \
+    "var pageSize = 4096\n"                                              \
+    "var pages = 256\n"                                                  \
+    "var budget = pageSize * pages\n"                                    \
+    "var name = \"cache-\" + pages\n"                                    \
+    "{\n"                                                                \
+    "var reserve = budget / 8\n"                                         \
+    "budget = budget - reserve\n"                                        \
+    "}\n"                                                                \
+    "print name + \": \" + budget / 1024 + \" KiB\"\n"                    \
+    "print budget > 1000000\n"
+
+static void BenchCompileTime()
+{
+    constexpr auto table = EvaluateScript<EMBEDDED_SCRIPT>();
+    static_assert(table.Find("budget")->number == 917504);
+    constexpr int ROUNDS = 10000;
+
+    std::string_view source = EMBEDDED_SCRIPT;
+    std::streambuf* saved = std::cout.rdbuf(nullptr);
+
+    auto t0 = Clock::now();
+    for (int i = 0; i < ROUNDS; ++i)
+    {
+        TokenStream tokens = Lexer(source).Tokenize();
+        auto program = Parser(tokens).ParseProgram();
+        Interpreter interpreter;
+        interpreter.Execute(program);
+    }
+    auto t1 = Clock::now();
+    for (int i = 0; i < ROUNDS; ++i)
+        table.Print(std::cout);
+    auto t2 = Clock::now();
+
+    std::cout.rdbuf(saved);
+
+    std::printf("compile time: run at startup %.2f us, constant table %.2f us per script\n",
+                Seconds(t0, t1) * 1e6 / ROUNDS, Seconds(t1, t2) * 1e6 / ROUNDS);
+}
+
+int main(int argc, char* argv[])
+{
+    // The child run of BenchGovernor
+    if (argc > 1 && std::string(argv[1]) == "--tree-walk")
+    {
+        uint64_t steps = 0;
+        std::printf("%.9f\n", TreeWalkSeconds(&steps));
+        return 0;
+    }
+
+    BenchGovernor();
+    BenchParser();
+    BenchClosures("arithmetic", ArithmeticScript(200000));
+    BenchClosures("integer", IntegerScript(200000));
+    BenchIr();
+    BenchCalls();
+    BenchArrays();
+    BenchCompileTime();
+    return 0;
+}
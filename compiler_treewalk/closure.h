@@ -0,0 +1,619 @@
+#pragma once
+
+#include "ast.h"
+#include "governor.h"
+#include "scopes.h"
+#include "typeinfer.h"
+#include "value.h"
+
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Steps of the running statement. The tree walker charges one step per
+// node as it goes; compiled statements charge their whole cost at once,
+// after evaluating and before their effect. A node about to fail or to
+// allocate first charges the steps the tree walker would have taken up to
+// it, so errors and exhausted budgets are reported in the same order.
+struct StepMeter
+{
+    ResourceGovernor* governor;
+    uint64_t charged = 0; // steps of the running statement charged so far
+
+    // The statement's first 'steps' steps have been taken
+    void Reach(uint64_t steps)
+    {
+        governor->Step(steps - charged);
+        charged = steps;
+    }
+
+    // The statement, costing 'cost' steps, is complete
+    void Finish(uint64_t cost)
+    {
+        governor->Step(cost - charged);
+        charged = 0;
+    }
+};
+
+// One variable's storage. The compiler knows at every program point
+// whether a slot currently holds a boxed Value or an unboxed integer, so
+// the slot itself needs no tag.
+union Slot
+{
+    Value value;
+    int64_t integer;
+
+    Slot() : integer(0) {}
+};
+
+// Compiled code receives the slot array of the running program
+using ExprFn = std::function<Value(Slot*)>;
+using IntFn = std::function<int64_t(Slot*)>;
+using StmtFn = std::function<void(Slot*)>;
+
+// Closure-compilation tier.
+//
+// Compile() converts every statement and expression into a pre-specialized
+// callable ahead of execution: variables are resolved to slots, operators
+// are template arguments, and operands that are slots or constants are
+// loaded inline instead of through a nested call, so "x = y + 1" is one
+// closure. Execute() is then a loop of direct calls with no dynamic_cast
+// and no operator switch.
+//
+// The language has no control flow, so every statement runs exactly once,
+// in order. That makes static resolution exact: each 'var' gets its own
+// slot, blocks cost nothing at run time, and name errors found while
+// compiling are emitted as closures that throw when reached, after all
+// earlier output. It also makes type inference exact: the compiler tracks
+// the IntRange of every slot as it goes, and expressions proven integral
+// (see typeinfer.h) run on int64 and are stored unboxed.
+class ClosureCompiler
+{
+private:
+    // Closures call into their operands, so expression nesting costs native
+    // stack here; deeper programs are left to the tree walker.
+    static constexpr size_t MAX_DEPTH = 2000;
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor;
+    StepMeter meter;
+
+    StringTable strings;
+
+    ScopeTable<size_t> scopes; // name -> slot
+    std::vector<IntRange> slotRanges; // what each slot holds at this point
+    uint64_t steps = 0; // tree-walker steps of the statement up to the node being compiled
+
+    std::vector<StmtFn> code;
+    std::vector<Slot> slots;
+
+    // An expression after compilation. Slots and constants are kept as
+    // operands so the parent can load them inline; everything else is code.
+    struct Compiled
+    {
+        enum Kind { SLOT, CONST, CODE };
+
+        Kind kind = CODE;
+        IntRange range;  // range.integral: evaluates to an int64
+
+        size_t slot = 0; // SLOT
+        Value constant;  // CONST
+        ExprFn value;    // CODE, not integral
+        IntFn integer;   // CODE, integral
+    };
+
+public:
+    ClosureCompiler()
+        : governor(ownGovernor), meter{&governor}, strings(governor)
+    {
+    }
+
+    explicit ClosureCompiler(ResourceGovernor& g)
+        : governor(g), meter{&governor}, strings(governor)
+    {
+    }
+
+    void Compile(const std::vector<std::unique_ptr<Stmt>>& statements)
+    {
+        struct Frame
+        {
+            const std::vector<std::unique_ptr<Stmt>>* statements;
+            size_t next;
+        };
+
+        std::vector<Frame> frames{{&statements, 0}};
+        uint64_t blockSteps = 0; // charged with the next statement
+
+        scopes.Reset();
+        code.reserve(statements.size());
+
+        while (!frames.empty())
+        {
+            Frame& frame = frames.back();
+
+            if (frame.next == frame.statements->size())
+            {
+                frames.pop_back();
+                if (!frames.empty())
+                    scopes.PopScope();
+                continue;
+            }
+
+            const Stmt* stmt = (*frame.statements)[frame.next++].get();
+
+            if (auto block = dynamic_cast<const BlockStmt*>(stmt))
+            {
+                blockSteps++;
+                scopes.PushScope();
+                frames.push_back({&block->statements, 0});
+                continue;
+            }
+
+            code.push_back(CompileStmt(stmt, blockSteps));
+            blockSteps = 0;
+        }
+
+        if (blockSteps > 0)
+        {
+            ResourceGovernor* g = &governor;
+            code.push_back([g, blockSteps](Slot*) { g->Step(blockSteps); });
+        }
+    }
+
+    void Execute()
+    {
+        governor.Charge(slotRanges.size() * sizeof(Slot));
+        slots.assign(slotRanges.size(), Slot());
+
+        Slot* s = slots.data();
+        for (const StmtFn& stmt : code)
+            stmt(s);
+    }
+
+private:
+    // ---------------- STATEMENTS ----------------
+
+    StmtFn CompileStmt(const Stmt* stmt, uint64_t extraSteps)
+    {
+        steps = 1 + extraSteps;
+
+        // Assignment: x = expression
+        if (auto assign = dynamic_cast<const AssignStmt*>(stmt))
+        {
+            const size_t* slot = scopes.Find(assign->name);
+            if (!slot)
+                return Fail(assign->value.get(), "Undefined variable: " + assign->name);
+
+            return CompileStore(*slot, assign->value.get());
+        }
+
+        if (auto varDecl = dynamic_cast<const VarDeclStmt*>(stmt))
+        {
+            if (scopes.DeclaredInScope(varDecl->name))
+                return Fail(varDecl->initializer.get(),
+                            "Variable already declared in this scope: " + varDecl->name);
+
+            // The initializer is resolved before the name is in scope
+            size_t slot = slotRanges.size();
+            slotRanges.emplace_back();
+            StmtFn store = CompileStore(slot, varDecl->initializer.get());
+            scopes.Declare(varDecl->name, slot);
+            return store;
+        }
+
+        // Print: print expression
+        if (auto print = dynamic_cast<const PrintStmt*>(stmt))
+        {
+            Compiled c = CompileExpr(print->value.get(), 0);
+            uint64_t cost = steps;
+            StepMeter* m = &meter;
+
+            // Integers print through double, exactly as the tree walker does
+            if (c.range.integral)
+            {
+                return [m, cost, f = ToInt(std::move(c))](Slot* s)
+                {
+                    int64_t v = f(s);
+                    m->Finish(cost);
+                    std::cout << static_cast<double>(v) << std::endl;
+                };
+            }
+
+            return [m, cost, f = ToValue(std::move(c))](Slot* s)
+            {
+                Value v = f(s);
+                m->Finish(cost);
+                PrintValue(std::cout, v);
+                std::cout << std::endl;
+            };
+        }
+
+        throw UnsupportedProgram("Unknown statement type");
+    }
+
+    // s[slot] = expr. A binary op on slots and constants is emitted as a
+    // single closure.
+    StmtFn CompileStore(size_t slot, const Expr* expr)
+    {
+        auto bin = dynamic_cast<const BinaryExpr*>(expr);
+        if (!bin)
+        {
+            Compiled c = CompileExpr(expr, 0);
+            return Store(slot, std::move(c), steps);
+        }
+
+        steps++;
+        Compiled l = CompileExpr(bin->left.get(), 1);
+        Compiled r = CompileExpr(bin->right.get(), 1);
+        uint64_t cost = steps;
+
+        if (l.kind == Compiled::CODE || r.kind == Compiled::CODE)
+            return Store(slot, EmitBinary(bin->op, std::move(l), std::move(r)), cost);
+
+        StepMeter* m = &meter;
+        StringTable* st = &strings;
+        IntRange range = InferBinary(bin->op, l.range, r.range);
+        slotRanges[slot] = range;
+
+        if (range.integral)
+        {
+            return ForOperator<StmtFn>(bin->op, [&](auto op) -> StmtFn
+            {
+                return WithIntOperands<StmtFn>(l, r, [&](auto lo, auto ro) -> StmtFn
+                {
+                    return [lo = std::move(lo), ro = std::move(ro), m, cost, slot](Slot* s)
+                    {
+                        int64_t v = IntApply<decltype(op)::value>(lo(s), ro(s));
+                        m->Finish(cost);
+                        s[slot].integer = v;
+                    };
+                });
+            });
+        }
+
+        return ForOperator<StmtFn>(bin->op, [&](auto op) -> StmtFn
+        {
+            return WithValueOperands<StmtFn>(l, r, [&](auto lo, auto ro) -> StmtFn
+            {
+                return [lo = std::move(lo), ro = std::move(ro), st, m, cost, slot](Slot* s)
+                {
+                    Value lv = lo(s);
+                    Value v = Apply<decltype(op)::value>(lv, ro(s), *st, *m, cost);
+                    m->Finish(cost);
+                    s[slot].value = v;
+                };
+            });
+        });
+    }
+
+    StmtFn Store(size_t slot, Compiled c, uint64_t cost)
+    {
+        StepMeter* m = &meter;
+        slotRanges[slot] = c.range;
+
+        if (c.range.integral)
+        {
+            return [m, cost, slot, f = ToInt(std::move(c))](Slot* s)
+            {
+                int64_t v = f(s);
+                m->Finish(cost);
+                s[slot].integer = v;
+            };
+        }
+
+        return [m, cost, slot, f = ToValue(std::move(c))](Slot* s)
+        {
+            Value v = f(s);
+            m->Finish(cost);
+            s[slot].value = v;
+        };
+    }
+
+    // Evaluates 'expr' for its errors, then reports 'message'
+    StmtFn Fail(const Expr* expr, std::string message)
+    {
+        ExprFn value = ToValue(CompileExpr(expr, 0));
+        uint64_t cost = steps;
+        StepMeter* m = &meter;
+
+        return [m, cost, value = std::move(value), message = std::move(message)](Slot* s)
+        {
+            value(s);
+            m->Finish(cost);
+            throw std::runtime_error(message);
+        };
+    }
+
+    // ---------------- EXPRESSIONS ----------------
+
+    Compiled CompileExpr(const Expr* expr, size_t depth)
+    {
+        if (depth > MAX_DEPTH)
+            throw UnsupportedProgram("Expression too deeply nested for closure mode");
+
+        steps++;
+        Compiled c;
+
+        // Number literal
+        if (auto num = dynamic_cast<const NumberExpr*>(expr))
+        {
+            c.kind = Compiled::CONST;
+            c.constant = Value::Number(num->value);
+            c.range = InferNumber(num->value);
+            return c;
+        }
+
+        // String literal, interned once here
+        if (auto str = dynamic_cast<const StringExpr*>(expr))
+        {
+            c.kind = Compiled::CONST;
+            c.constant = strings.Intern(str->value);
+            return c;
+        }
+
+        // Variable reference
+        if (auto var = dynamic_cast<const VariableExpr*>(expr))
+        {
+            const size_t* slot = scopes.Find(var->name);
+            if (!slot)
+            {
+                std::string message = "Undefined variable: " + var->name;
+                c.value = [m = &meter, at = steps, message](Slot*) -> Value
+                {
+                    m->Reach(at);
+                    throw std::runtime_error(message);
+                };
+                return c;
+            }
+
+            c.kind = Compiled::SLOT;
+            c.slot = *slot;
+            c.range = slotRanges[*slot];
+            return c;
+        }
+
+        if (auto unary = dynamic_cast<const UnaryExpr*>(expr))
+        {
+            Compiled operand = CompileExpr(unary->operand.get(), depth + 1);
+            TokenType op = unary->op;
+            c.range = InferUnary(op, operand.range);
+
+            if (c.range.integral)
+                c.integer = [f = ToInt(std::move(operand))](Slot* s) { return -f(s); };
+            else
+                c.value = [f = ToValue(std::move(operand)), op, m = &meter, at = steps](Slot* s)
+                {
+                    Value v = f(s);
+                    if (!v.IsNumber())
+                        m->Reach(at);
+                    return ApplyUnary(op, v);
+                };
+            return c;
+        }
+
+        // Binary operation: left is evaluated first
+        if (auto bin = dynamic_cast<const BinaryExpr*>(expr))
+        {
+            Compiled l = CompileExpr(bin->left.get(), depth + 1);
+            Compiled r = CompileExpr(bin->right.get(), depth + 1);
+            return EmitBinary(bin->op, std::move(l), std::move(r));
+        }
+
+        throw UnsupportedProgram("Unknown expression type");
+    }
+
+    // Called once both operands are compiled, so 'steps' covers them
+    Compiled EmitBinary(TokenType op, Compiled l, Compiled r)
+    {
+        StringTable* st = &strings;
+        StepMeter* m = &meter;
+        uint64_t at = steps;
+        Compiled c;
+        c.range = InferBinary(op, l.range, r.range);
+
+        if (c.range.integral)
+        {
+            c.integer = ForOperator<IntFn>(op, [&](auto op) -> IntFn
+            {
+                return WithIntOperands<IntFn>(l, r, [&](auto lo, auto ro) -> IntFn
+                {
+                    return [lo = std::move(lo), ro = std::move(ro)](Slot* s)
+                    {
+                        return IntApply<decltype(op)::value>(lo(s), ro(s));
+                    };
+                });
+            });
+            return c;
+        }
+
+        c.value = ForOperator<ExprFn>(op, [&](auto op) -> ExprFn
+        {
+            return WithValueOperands<ExprFn>(l, r, [&](auto lo, auto ro) -> ExprFn
+            {
+                return [lo = std::move(lo), ro = std::move(ro), st, m, at](Slot* s)
+                {
+                    Value lv = lo(s);
+                    return Apply<decltype(op)::value>(lv, ro(s), *st, *m, at);
+                };
+            });
+        });
+        return c;
+    }
+
+    // ---------------- OPERANDS ----------------
+    //
+    // Small function objects that load an operand. Binary closures are
+    // instantiated per (operator, left loader, right loader), so a slot or
+    // constant operand is a plain load instead of a std::function call.
+
+    struct ValueSlot
+    {
+        size_t a;
+        Value operator()(Slot* s) const { return s[a].value; }
+    };
+
+    struct ValueConst
+    {
+        Value v;
+        Value operator()(Slot*) const { return v; }
+    };
+
+    struct ValueCode
+    {
+        ExprFn f;
+        Value operator()(Slot* s) const { return f(s); }
+    };
+
+    struct IntSlot
+    {
+        size_t a;
+        int64_t operator()(Slot* s) const { return s[a].integer; }
+    };
+
+    struct IntConst
+    {
+        int64_t v;
+        int64_t operator()(Slot*) const { return v; }
+    };
+
+    struct IntCode
+    {
+        IntFn f;
+        int64_t operator()(Slot* s) const { return f(s); }
+    };
+
+    // An integral operand where a Value is needed, boxed by the loader
+    // instead of by another closure
+    template <typename IntLoader>
+    struct Boxed
+    {
+        IntLoader f;
+        Value operator()(Slot* s) const { return Value::Number(static_cast<double>(f(s))); }
+    };
+
+    template <typename R, typename Sink>
+    R WithValueOperands(Compiled& l, Compiled& r, Sink sink)
+    {
+        return WithValueOperand<R>(l, [&](auto lo)
+        {
+            return WithValueOperand<R>(r, [&](auto ro) { return sink(std::move(lo), std::move(ro)); });
+        });
+    }
+
+    template <typename R, typename Sink>
+    R WithValueOperand(Compiled& c, Sink sink)
+    {
+        if (c.kind == Compiled::CONST)
+            return sink(ValueConst{c.constant});
+        if (c.range.integral && c.kind == Compiled::SLOT)
+            return sink(Boxed<IntSlot>{IntSlot{c.slot}});
+        if (c.range.integral)
+            return sink(Boxed<IntCode>{IntCode{std::move(c.integer)}});
+        if (c.kind == Compiled::SLOT)
+            return sink(ValueSlot{c.slot});
+        return sink(ValueCode{std::move(c.value)});
+    }
+
+    template <typename R, typename Sink>
+    R WithIntOperands(Compiled& l, Compiled& r, Sink sink)
+    {
+        return WithIntOperand<R>(l, [&](auto lo)
+        {
+            return WithIntOperand<R>(r, [&](auto ro) { return sink(std::move(lo), std::move(ro)); });
+        });
+    }
+
+    template <typename R, typename Sink>
+    R WithIntOperand(Compiled& c, Sink sink)
+    {
+        if (c.kind == Compiled::CONST)
+            return sink(IntConst{c.range.lo});
+        if (c.kind == Compiled::SLOT)
+            return sink(IntSlot{c.slot});
+        return sink(IntCode{std::move(c.integer)});
+    }
+
+    // Any compiled expression as boxed code; integers are converted
+    ExprFn ToValue(Compiled c)
+    {
+        if (c.range.integral)
+        {
+            return Boxed<IntFn>{ToInt(std::move(c))};
+        }
+
+        switch (c.kind)
+        {
+        case Compiled::CONST: return ValueConst{c.constant};
+        case Compiled::SLOT:  return ValueSlot{c.slot};
+        default:              return std::move(c.value);
+        }
+    }
+
+    // An integral compiled expression as unboxed code
+    IntFn ToInt(Compiled c)
+    {
+        switch (c.kind)
+        {
+        case Compiled::CONST: return IntConst{c.range.lo};
+        case Compiled::SLOT:  return IntSlot{c.slot};
+        default:              return std::move(c.integer);
+        }
+    }
+
+    // ---------------- HELPERS ----------------
+
+    // Binary operator with the operator fixed at compile time, so the
+    // numeric case is a single instruction after inlining. Anything else
+    // may fail or allocate, after the operator's first 'at' steps.
+    template <TokenType OP>
+    static Value Apply(Value left, Value right, StringTable& st, StepMeter& m, uint64_t at)
+    {
+        if (left.IsNumber() && right.IsNumber())
+            return Value::Number(NumberBinary(OP, left.AsNumber(), right.AsNumber()));
+        m.Reach(at);
+        return MixedBinary(OP, left, right, st);
+    }
+
+    // Only reached for operators InferBinary can prove integral
+    template <TokenType OP>
+    static int64_t IntApply(int64_t left, int64_t right)
+    {
+        using T = TokenType;
+        if constexpr (OP == T::PLUS)               return left + right;
+        else if constexpr (OP == T::MINUS)         return left - right;
+        else if constexpr (OP == T::STAR)          return left * right;
+        else if constexpr (OP == T::EQUAL_EQUAL)   return left == right;
+        else if constexpr (OP == T::NOT_EQUAL)     return left != right;
+        else if constexpr (OP == T::LESS)          return left < right;
+        else if constexpr (OP == T::LESS_EQUAL)    return left <= right;
+        else if constexpr (OP == T::GREATER)       return left > right;
+        else if constexpr (OP == T::GREATER_EQUAL) return left >= right;
+        else throw std::logic_error("Operator has no integer form");
+    }
+
+    // Calls make(std::integral_constant<TokenType, op>) so the closure it
+    // returns is instantiated for that one operator
+    template <typename Fn, typename Make>
+    static Fn ForOperator(TokenType op, Make make)
+    {
+        using T = TokenType;
+        switch (op)
+        {
+        case T::PLUS:          return make(std::integral_constant<T, T::PLUS>{});
+        case T::MINUS:         return make(std::integral_constant<T, T::MINUS>{});
+        case T::STAR:          return make(std::integral_constant<T, T::STAR>{});
+        case T::SLASH:         return make(std::integral_constant<T, T::SLASH>{});
+        case T::EQUAL_EQUAL:   return make(std::integral_constant<T, T::EQUAL_EQUAL>{});
+        case T::NOT_EQUAL:     return make(std::integral_constant<T, T::NOT_EQUAL>{});
+        case T::LESS:          return make(std::integral_constant<T, T::LESS>{});
+        case T::LESS_EQUAL:    return make(std::integral_constant<T, T::LESS_EQUAL>{});
+        case T::GREATER:       return make(std::integral_constant<T, T::GREATER>{});
+        case T::GREATER_EQUAL: return make(std::integral_constant<T, T::GREATER_EQUAL>{});
+        default:
+            throw UnsupportedProgram("Unknown binary operator");
+        }
+    }
+};
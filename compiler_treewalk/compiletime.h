@@ -0,0 +1,543 @@
+#pragma once
+
+#include "ast.h"
+#include "lexer.h"
+#include "parser.h"
+#include "value.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// ---------- Compile-time evaluation ----------
+//
+// EvaluateScript<"...">() lexes, parses and runs a script literal during
+// constant evaluation and returns a constant table of everything it
+// printed and of its global variables at the end. An invalid script
+// (syntax error, undefined variable, bad operands) is a compile error.
+//
+//   constexpr auto limits = EvaluateScript<"var max = 8 * 1024\nprint max\n">();
+//   static_assert(limits.Find("max")->number == 8192);
+//
+// Lexer and Parser are the ones used at run time. Interpreter is not: its
+// NaN-boxed strings are pointers into a hash set, neither of which can
+// exist in a constant expression. ConstantEvaluator below runs the same
+// AST with the same rules and error messages, holding strings by value;
+// tests/compiletime.cpp checks that the two agree.
+//
+// Needs C++23 (-std=c++2b) for constexpr std::unique_ptr.
+
+// ================= NUMBER FORMATTING =================
+
+// The text 'std::ostream << double' produces with default flags (%g with
+// six significant digits), for string concatenation. Exact rounding needs
+// the double's value as a fraction of two 128-bit integers, which limits
+// it to magnitudes from about 1e-15 to 1e21; other numbers (and only
+// those) cannot be concatenated during constant evaluation.
+constexpr std::string FormatNumber(double d)
+{
+    using u128 = unsigned __int128;
+
+    uint64_t bits = std::bit_cast<uint64_t>(d);
+    int biased = static_cast<int>((bits >> 52) & 0x7ff);
+    uint64_t fraction = bits & ((uint64_t(1) << 52) - 1);
+
+    // Built by appending to one string, which sidesteps GCC 12 bugs with
+    // std::string temporaries in constant expressions
+    std::string out;
+    if (bits >> 63)
+        out.push_back('-');
+
+    if (biased == 0x7ff)
+        return out.append(fraction ? "nan" : "inf");
+    if (biased == 0 && fraction == 0)
+        return out.append("0");
+
+    // |d| = mantissa * 2^exponent, with mantissa odd
+    uint64_t mantissa = biased ? fraction | (uint64_t(1) << 52) : fraction;
+    int exponent = (biased ? biased : 1) - 1075;
+    while ((mantissa & 1) == 0)
+    {
+        mantissa >>= 1;
+        exponent++;
+    }
+
+    auto multiply = [](u128 a, u128 b)
+    {
+        if (b != 0 && a > ~u128(0) / b)
+            throw std::runtime_error("Number out of range for constant evaluation");
+        return a * b;
+    };
+    auto power = [&](u128 base, int n)
+    {
+        u128 p = 1;
+        for (int i = 0; i < n; ++i)
+            p = multiply(p, base);
+        return p;
+    };
+
+    // |d| * 10^(5 - x) = num / den, so that 10^5 <= num / den < 10^6 once
+    // x is the decimal exponent of |d|
+    int x = (exponent + static_cast<int>(std::bit_width(mantissa)) - 1) * 30103 / 100000;
+    u128 num = 0;
+    u128 den = 0;
+    for (;;)
+    {
+        int shift = 5 - x;
+        num = multiply(multiply(mantissa, power(2, std::max(exponent, 0))),
+                       power(10, std::max(shift, 0)));
+        den = multiply(power(2, std::max(-exponent, 0)), power(10, std::max(-shift, 0)));
+
+        u128 whole = num / den;
+        if (whole >= 1000000)
+            x++;
+        else if (whole < 100000)
+            x--;
+        else
+            break;
+    }
+
+    // Round half to even, like printf
+    u128 digits = num / den;
+    u128 rest = num % den;
+    if (rest * 2 > den || (rest * 2 == den && (digits & 1)))
+        digits++;
+    if (digits == 1000000)
+    {
+        digits = 100000;
+        x++;
+    }
+
+    char buffer[6] = {};
+    for (int i = 5; i >= 0; --i)
+    {
+        buffer[i] = static_cast<char>('0' + static_cast<int>(digits % 10));
+        digits /= 10;
+    }
+    std::string_view significant(buffer, 6);
+
+    // Trailing zeros of the decimals are dropped, and the point with them
+    auto append = [&](std::string_view whole, std::string_view decimals)
+    {
+        while (!decimals.empty() && decimals.back() == '0')
+            decimals.remove_suffix(1);
+        out.append(whole);
+        if (!decimals.empty())
+            out.append(".").append(decimals);
+    };
+
+    if (x < -4 || x >= 6)
+    {
+        append(significant.substr(0, 1), significant.substr(1));
+        out.append(x < 0 ? "e-" : "e+");
+
+        int e = x < 0 ? -x : x;
+        if (e >= 100)
+            out.push_back(static_cast<char>('0' + e / 100));
+        out.push_back(static_cast<char>('0' + e / 10 % 10));
+        out.push_back(static_cast<char>('0' + e % 10));
+        return out;
+    }
+
+    if (x < 0)
+    {
+        std::string decimals(-x - 1, '0');
+        append("0", decimals.append(significant));
+        return out;
+    }
+
+    append(significant.substr(0, x + 1), significant.substr(x + 1));
+    return out;
+}
+
+// ================= EVALUATOR =================
+
+struct ScriptValue
+{
+    bool isString = false;
+    double number = 0;
+    std::string text;
+
+    // Not a conditional expression: GCC 12 then builds a string whose
+    // small-string buffer it later refuses to read
+    constexpr std::string Printed() const
+    {
+        if (isString)
+            return text;
+        return FormatNumber(number);
+    }
+};
+
+// Runs an AST like Interpreter::Execute, recording prints instead of
+// writing them. The global scope keeps its declaration order.
+class ConstantEvaluator
+{
+private:
+    using Scope = std::vector<std::pair<std::string, ScriptValue>>;
+
+    std::vector<Scope> scopes;
+    std::vector<ScriptValue> printed;
+
+    struct Frame
+    {
+        const std::vector<std::unique_ptr<Stmt>>* statements;
+        size_t next;
+    };
+
+    struct Work
+    {
+        enum Kind { VISIT, APPLY_UNARY, APPLY_BINARY };
+
+        const Expr* expr;
+        Kind kind;
+    };
+
+public:
+    constexpr void Execute(const std::vector<std::unique_ptr<Stmt>>& statements)
+    {
+        // Calls would need the interpreter's frame machinery
+        for (const auto& stmt : statements)
+            if (NodeCast<FunctionStmt>(stmt.get()))
+                throw std::runtime_error("Functions are not supported in constant evaluation");
+
+        std::vector<Frame> frames;
+        scopes.assign(1, {});
+        frames.push_back({&statements, 0});
+
+        while (!frames.empty())
+        {
+            Frame& frame = frames.back();
+
+            if (frame.next == frame.statements->size())
+            {
+                frames.pop_back();
+                if (!frames.empty())
+                    scopes.pop_back();
+                continue;
+            }
+
+            const Stmt* stmt = (*frame.statements)[frame.next++].get();
+
+            if (auto block = NodeCast<BlockStmt>(stmt))
+            {
+                scopes.emplace_back();
+                frames.push_back({&block->statements, 0});
+                continue;
+            }
+
+            ExecuteStmt(stmt);
+        }
+    }
+
+    constexpr const std::vector<ScriptValue>& Printed() const
+    {
+        return printed;
+    }
+
+    constexpr const Scope& Globals() const
+    {
+        return scopes.front();
+    }
+
+private:
+    // ---------------- STATEMENTS ----------------
+
+    constexpr void ExecuteStmt(const Stmt* stmt)
+    {
+        if (auto assign = NodeCast<AssignStmt>(stmt))
+        {
+            ScriptValue value = EvaluateExpr(assign->value.get());
+            Lookup(assign->name) = std::move(value);
+            return;
+        }
+
+        if (auto varDecl = NodeCast<VarDeclStmt>(stmt))
+        {
+            ScriptValue value = EvaluateExpr(varDecl->initializer.get());
+            for (const auto& [name, _] : scopes.back())
+                if (name == varDecl->name)
+                    throw std::runtime_error("Variable already declared in this scope: " + name);
+            scopes.back().emplace_back(varDecl->name, std::move(value));
+            return;
+        }
+
+        if (auto print = NodeCast<PrintStmt>(stmt))
+        {
+            printed.push_back(EvaluateExpr(print->value.get()));
+            return;
+        }
+
+        if (NodeCast<IndexAssignStmt>(stmt) || NodeCast<ExprStmt>(stmt))
+            throw std::runtime_error("Arrays are not supported in constant evaluation");
+
+        throw std::runtime_error("Unknown statement type");
+    }
+
+    constexpr ScriptValue& Lookup(const std::string& name)
+    {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+            for (auto& [key, value] : *scope)
+                if (key == name)
+                    return value;
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+
+    // ---------------- EXPRESSIONS ----------------
+
+    // The VISIT / APPLY_UNARY / APPLY_BINARY part of Interpreter::Evaluate
+    // (treewalk.h): operands are pushed right before left, so the left one
+    // is evaluated first and errors come in the same order
+    constexpr ScriptValue EvaluateExpr(const Expr* expr)
+    {
+        std::vector<Work> work;
+        std::vector<ScriptValue> values;
+
+        work.push_back({expr, Work::VISIT});
+
+        while (!work.empty())
+        {
+            Work item = work.back();
+            work.pop_back();
+
+            if (item.kind == Work::APPLY_BINARY)
+            {
+                auto bin = static_cast<const BinaryExpr*>(item.expr);
+                ScriptValue right = std::move(values.back());
+                values.pop_back();
+                values.back() = Binary(bin->op, values.back(), right);
+                continue;
+            }
+
+            if (item.kind == Work::APPLY_UNARY)
+            {
+                auto unary = static_cast<const UnaryExpr*>(item.expr);
+                if (values.back().isString)
+                    throw std::runtime_error("Operand must be a number");
+                if (unary->op != TokenType::MINUS)
+                    throw std::runtime_error("Unknown unary operator");
+                values.back().number = -values.back().number;
+                continue;
+            }
+
+            if (auto num = NodeCast<NumberExpr>(item.expr))
+            {
+                values.push_back({false, num->value, {}});
+                continue;
+            }
+
+            if (auto var = NodeCast<VariableExpr>(item.expr))
+            {
+                values.push_back(Lookup(var->name));
+                continue;
+            }
+
+            if (auto bin = NodeCast<BinaryExpr>(item.expr))
+            {
+                work.push_back({bin, Work::APPLY_BINARY});
+                work.push_back({bin->right.get(), Work::VISIT});
+                work.push_back({bin->left.get(), Work::VISIT});
+                continue;
+            }
+
+            if (auto unary = NodeCast<UnaryExpr>(item.expr))
+            {
+                work.push_back({unary, Work::APPLY_UNARY});
+                work.push_back({unary->operand.get(), Work::VISIT});
+                continue;
+            }
+
+            if (auto str = NodeCast<StringExpr>(item.expr))
+            {
+                values.push_back({true, 0, str->value});
+                continue;
+            }
+
+            // Calls can only be to builtins here, which all take arrays
+            if (NodeCast<ArrayExpr>(item.expr) || NodeCast<IndexExpr>(item.expr) ||
+                NodeCast<CallExpr>(item.expr))
+                throw std::runtime_error("Arrays are not supported in constant evaluation");
+
+            throw std::runtime_error("Unknown expression type");
+        }
+
+        return std::move(values.back());
+    }
+
+    // ApplyBinary and MixedBinary, with strings compared by contents where
+    // the interpreter compares interned pointers
+    static constexpr ScriptValue Binary(TokenType op, const ScriptValue& left,
+                                        const ScriptValue& right)
+    {
+        if (!left.isString && !right.isString)
+            return {false, NumberBinary(op, left.number, right.number), {}};
+
+        switch (op)
+        {
+        case TokenType::PLUS:
+        {
+            std::string text = left.Printed();
+            return {true, 0, text.append(right.Printed())};
+        }
+
+        case TokenType::EQUAL_EQUAL:
+            return {false, double(left.isString == right.isString && left.text == right.text), {}};
+        case TokenType::NOT_EQUAL:
+            return {false, double(left.isString != right.isString || left.text != right.text), {}};
+
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        {
+            if (!left.isString || !right.isString)
+                throw std::runtime_error("Operands must be two numbers or two strings");
+
+            int c = left.text.compare(right.text);
+            return {false, NumberBinary(op, c, 0), {}};
+        }
+
+        default:
+            throw std::runtime_error("Operands must be numbers");
+        }
+    }
+};
+
+// ================= CONSTANT TABLES =================
+
+// A string literal usable as a template argument
+template <size_t N>
+struct ScriptLiteral
+{
+    char text[N];
+
+    constexpr ScriptLiteral(const char (&s)[N])
+    {
+        std::copy_n(s, N, text);
+    }
+
+    constexpr std::string_view View() const
+    {
+        return {text, N - 1};
+    }
+};
+
+// A printed value or a variable's final value; strings are slices of
+// ScriptResult::text
+struct ConstantValue
+{
+    bool isString;
+    double number;
+    uint32_t text;
+    uint32_t size;
+};
+
+struct ConstantBinding
+{
+    uint32_t name;
+    uint32_t nameSize;
+    ConstantValue value;
+};
+
+template <size_t Prints, size_t Bindings, size_t TextSize>
+struct ScriptResult
+{
+    std::array<ConstantValue, Prints> prints;
+    std::array<ConstantBinding, Bindings> bindings; // declaration order
+    std::array<char, TextSize> text;
+
+    constexpr std::string_view Text(const ConstantValue& v) const
+    {
+        return {text.data() + v.text, v.size};
+    }
+
+    constexpr std::string_view Name(const ConstantBinding& b) const
+    {
+        return {text.data() + b.name, b.nameSize};
+    }
+
+    // The final value of global 'name', or nullptr
+    constexpr const ConstantValue* Find(std::string_view name) const
+    {
+        for (const ConstantBinding& b : bindings)
+            if (Name(b) == name)
+                return &b.value;
+        return nullptr;
+    }
+
+    // Writes what the interpreter would have printed
+    void Print(std::ostream& out) const
+    {
+        for (const ConstantValue& v : prints)
+        {
+            if (v.isString)
+                out << Text(v);
+            else
+                out << v.number;
+            out << '\n';
+        }
+    }
+};
+
+// Lexes, parses and evaluates 'source'; a failure anywhere throws
+constexpr ConstantEvaluator RunScript(std::string_view source)
+{
+    TokenStream tokens = Lexer(source).Tokenize();
+    auto program = Parser(tokens).ParseProgram();
+
+    ConstantEvaluator evaluator;
+    evaluator.Execute(program);
+    return evaluator;
+}
+
+// Runs the script twice: once to size the table, once to fill it, since
+// nothing allocated during constant evaluation can survive into the result.
+template <ScriptLiteral Script>
+consteval auto EvaluateScript()
+{
+    constexpr std::array<size_t, 3> sizes = []
+    {
+        ConstantEvaluator run = RunScript(Script.View());
+        size_t text = 0;
+        for (const ScriptValue& v : run.Printed())
+            text += v.text.size();
+        for (const auto& [name, v] : run.Globals())
+            text += name.size() + v.text.size();
+        return std::array<size_t, 3>{run.Printed().size(), run.Globals().size(), text};
+    }();
+
+    ScriptResult<sizes[0], sizes[1], sizes[2]> result{};
+    ConstantEvaluator run = RunScript(Script.View());
+    size_t used = 0;
+
+    auto store = [&](std::string_view s)
+    {
+        std::copy(s.begin(), s.end(), result.text.begin() + used);
+        used += s.size();
+        return static_cast<uint32_t>(used - s.size());
+    };
+    auto constant = [&](const ScriptValue& v)
+    {
+        uint32_t size = static_cast<uint32_t>(v.text.size());
+        return ConstantValue{v.isString, v.number, store(v.text), size};
+    };
+
+    for (size_t i = 0; i < sizes[0]; ++i)
+        result.prints[i] = constant(run.Printed()[i]);
+
+    for (size_t i = 0; i < sizes[1]; ++i)
+    {
+        const auto& [name, value] = run.Globals()[i];
+        uint32_t offset = store(name);
+        result.bindings[i] = {offset, static_cast<uint32_t>(name.size()), constant(value)};
+    }
+
+    return result;
+}
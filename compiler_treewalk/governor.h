@@ -0,0 +1,190 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// ---------- Errors ----------
+
+// Base class so callers can catch "any budget ran out" in one place,
+// while each limit still has its own type and message.
+struct ResourceLimitError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct StepLimitError : ResourceLimitError
+{
+    using ResourceLimitError::ResourceLimitError;
+};
+
+struct MemoryLimitError : ResourceLimitError
+{
+    using ResourceLimitError::ResourceLimitError;
+};
+
+struct DeadlineError : ResourceLimitError
+{
+    using ResourceLimitError::ResourceLimitError;
+};
+
+// ---------- Governor ----------
+
+// Tracks the execution budget of one script run.
+//
+// Step() is called once per executed statement and evaluated expression, so
+// it only decrements a counter. The expensive checks (total steps, clock)
+// happen in Refuel() once per slice of SLICE steps.
+//
+// Everything is constexpr so the lexer and parser can run during constant
+// evaluation; the clock is never read there and the deadline never trips.
+//
+// Building with -DUNGOVERNED turns the accounting into no-ops. Only
+// 'make bench' does that, to time the same run with and without it.
+class ResourceGovernor
+{
+public:
+    // A limit of zero means "unlimited".
+    struct Limits
+    {
+        uint64_t maxSteps = 0;
+        size_t maxMemory = 0;                 // bytes of AST + scopes
+        std::chrono::milliseconds timeout{0}; // wall clock, from construction
+    };
+
+    constexpr ResourceGovernor()
+        : ResourceGovernor(Limits{})
+    {
+    }
+
+    explicit constexpr ResourceGovernor(const Limits& l)
+        : limits(l)
+    {
+        if (!std::is_constant_evaluated())
+        {
+            start = std::chrono::steady_clock::now();
+            deadline = start + l.timeout;
+        }
+
+        fuel = NextSlice();
+        sliceSize = fuel;
+    }
+
+    // ================= STEPS =================
+
+    constexpr void Step()
+    {
+#ifndef UNGOVERNED
+        if (--fuel == 0)
+            Refuel();
+#endif
+    }
+
+    // Accounts for n steps at once; used by tiers that know the cost of a
+    // whole statement up front.
+    constexpr void Step(uint64_t n)
+    {
+#ifndef UNGOVERNED
+        while (n >= fuel)
+        {
+            n -= fuel;
+            fuel = 1;
+            Step();
+        }
+        fuel -= n;
+#endif
+    }
+
+    constexpr uint64_t StepsUsed() const
+    {
+        return stepsBefore + (sliceSize - fuel);
+    }
+
+    // ================= MEMORY =================
+
+    constexpr void Charge(size_t bytes)
+    {
+#ifndef UNGOVERNED
+        memoryUsed += bytes;
+        if (limits.maxMemory != 0 && memoryUsed > limits.maxMemory)
+            throw MemoryLimitError("Memory budget exceeded (" +
+                                   std::to_string(limits.maxMemory) + " bytes)");
+#endif
+    }
+
+    constexpr void Release(size_t bytes)
+    {
+        memoryUsed -= bytes < memoryUsed ? bytes : memoryUsed;
+    }
+
+    constexpr size_t MemoryUsed() const
+    {
+        return memoryUsed;
+    }
+
+    // ================= DEADLINE =================
+
+    // For long-running work that does not go through Step() (e.g. parsing):
+    // like Step(), it only decrements a counter and reads the clock once per
+    // SLICE calls, but it never uses up steps.
+    constexpr void PollDeadline()
+    {
+#ifndef UNGOVERNED
+        if (--pollFuel == 0)
+        {
+            pollFuel = SLICE;
+            CheckDeadline();
+        }
+#endif
+    }
+
+    constexpr void CheckDeadline() const
+    {
+        if (limits.timeout.count() != 0 && !std::is_constant_evaluated() &&
+            std::chrono::steady_clock::now() >= deadline)
+            throw DeadlineError("Deadline exceeded (" +
+                                std::to_string(limits.timeout.count()) + " ms)");
+    }
+
+private:
+    // Steps between clock reads; small enough to keep deadline overshoot
+    // well below a millisecond on any realistic script.
+    static constexpr uint64_t SLICE = 4096;
+
+    Limits limits;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point deadline;
+
+    uint64_t fuel = 0;         // steps left in the current slice
+    uint64_t sliceSize = 0;    // size of the current slice
+    uint64_t stepsBefore = 0;  // steps consumed by finished slices
+    uint64_t pollFuel = SLICE; // PollDeadline() calls left before a clock read
+    size_t memoryUsed = 0;
+
+    constexpr void Refuel()
+    {
+        stepsBefore += sliceSize;
+
+        if (limits.maxSteps != 0 && stepsBefore > limits.maxSteps)
+            throw StepLimitError("Step budget exhausted (" +
+                                 std::to_string(limits.maxSteps) + " steps)");
+
+        CheckDeadline();
+
+        fuel = NextSlice();
+        sliceSize = fuel;
+    }
+
+    constexpr uint64_t NextSlice() const
+    {
+        if (limits.maxSteps == 0)
+            return SLICE;
+
+        // +1 so that the step *after* the last allowed one trips Refuel()
+        uint64_t left = limits.maxSteps + 1 - stepsBefore;
+        return left < SLICE ? left : SLICE;
+    }
+};
@@ -0,0 +1,713 @@
+// Build step: turns the 'grammar' file into LL(1) parse tables.
+//
+//   ./grammargen grammar > grammar_tables.h
+//
+// The grammar is read as EBNF, groups and repetitions are rewritten into
+// helper rules, and FIRST/FOLLOW sets give every production its predict
+// set. Two productions of one rule predicting the same token is an LL(1)
+// conflict: it is reported and the tool exits with status 1, which fails
+// the build. Otherwise each table entry is expanded down to its first
+// token and the tables are printed as constexpr arrays for TableParser
+// (table_parser.h).
+
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "token.h"
+
+// ---------- Terminals ----------
+
+struct TokenName
+{
+    TokenType type;
+    const char* name;     // enumerator, also usable in the grammar
+    const char* spelling; // "..." form in the grammar, if any
+};
+
+// Indexed by TokenType
+static const TokenName TOKENS[] = {
+    {TokenType::PLUS,          "PLUS",          "+"},
+    {TokenType::MINUS,         "MINUS",         "-"},
+    {TokenType::STAR,          "STAR",          "*"},
+    {TokenType::SLASH,         "SLASH",         "/"},
+    {TokenType::LPAREN,        "LPAREN",        "("},
+    {TokenType::RPAREN,        "RPAREN",        ")"},
+    {TokenType::LBRACE,        "LBRACE",        "{"},
+    {TokenType::RBRACE,        "RBRACE",        "}"},
+    {TokenType::LBRACKET,      "LBRACKET",      "["},
+    {TokenType::RBRACKET,      "RBRACKET",      "]"},
+    {TokenType::COMMA,         "COMMA",         ","},
+    {TokenType::ASSIGN,        "ASSIGN",        "="},
+    {TokenType::EQUAL_EQUAL,   "EQUAL_EQUAL",   "=="},
+    {TokenType::NOT_EQUAL,     "NOT_EQUAL",     "!="},
+    {TokenType::LESS,          "LESS",          "<"},
+    {TokenType::LESS_EQUAL,    "LESS_EQUAL",    "<="},
+    {TokenType::GREATER,       "GREATER",       ">"},
+    {TokenType::GREATER_EQUAL, "GREATER_EQUAL", ">="},
+    {TokenType::IDENTIFIER,    "IDENTIFIER",    nullptr},
+    {TokenType::NUMBER,        "NUMBER",        nullptr},
+    {TokenType::STRING,        "STRING",        nullptr},
+    {TokenType::PRINT,         "PRINT",         "print"},
+    {TokenType::VAR,           "VAR",           "var"},
+    {TokenType::FN,            "FN",            "fn"},
+    {TokenType::RETURN,        "RETURN",        "return"},
+    {TokenType::NEWLINE,       "NEWLINE",       nullptr},
+    {TokenType::END_OF_FILE,   "END_OF_FILE",   nullptr},
+    {TokenType::INVALID,       "INVALID",       nullptr},
+};
+
+static constexpr size_t TOKEN_TYPES = static_cast<size_t>(TokenType::INVALID) + 1;
+static_assert(std::size(TOKENS) == TOKEN_TYPES, "TOKENS must list every TokenType");
+static_assert(TOKEN_TYPES <= 32, "TOKEN_SETS are 32-bit masks");
+
+using TokenSet = std::bitset<TOKEN_TYPES>;
+
+// ---------- Grammar ----------
+
+struct Symbol
+{
+    enum Kind { TERMINAL, NONTERMINAL, ACTION, TOKEN_SET };
+
+    Kind kind;
+    size_t index; // TokenType, rule, action or token set
+};
+
+struct Production
+{
+    size_t lhs;
+    std::vector<Symbol> rhs;
+};
+
+class Grammar
+{
+public:
+    std::vector<std::string> rules;   // rules[0] is the start symbol
+    std::vector<std::string> origins; // the grammar rule each rule came from
+    std::vector<std::string> actions;
+    std::vector<TokenSet> tokenSets; // ("+" | "-") groups
+    std::vector<Production> productions;
+
+    void Read(const std::string& text)
+    {
+        // Join each rule with its continuation lines
+        std::istringstream lines(text);
+        std::string line, name, body;
+
+        while (std::getline(lines, line))
+        {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos)
+                line.erase(comment);
+
+            size_t arrow = line.find("→");
+            size_t arrowLength = 3;
+            if (arrow == std::string::npos)
+            {
+                arrow = line.find("->");
+                arrowLength = 2;
+            }
+
+            if (arrow == std::string::npos)
+            {
+                body += " " + line;
+                continue;
+            }
+
+            if (!name.empty())
+                AddRule(name, body);
+            name = Trim(line.substr(0, arrow));
+            body = line.substr(arrow + arrowLength);
+        }
+
+        if (!name.empty())
+            AddRule(name, body);
+
+        for (size_t i = 0; i < rules.size(); ++i)
+            if (!defined[i])
+                throw std::runtime_error("rule '" + rules[i] + "' is used but not defined");
+    }
+
+private:
+    std::map<std::string, size_t> ruleIndex;
+    std::map<std::string, size_t> actionIndex;
+    std::vector<bool> defined;
+    std::map<std::string, size_t> helpers; // per rule, for naming helper rules
+
+    // Body tokens: names, "quoted", @actions and ( ) | * ?
+    std::vector<std::string> items;
+    size_t next = 0;
+    std::string current; // rule being read
+
+    void AddRule(const std::string& name, const std::string& body)
+    {
+        size_t lhs = Rule(name);
+        if (defined[lhs])
+            throw std::runtime_error("rule '" + name + "' is defined twice");
+        defined[lhs] = true;
+
+        items = Split(body);
+        next = 0;
+        current = name;
+
+        std::vector<std::vector<Symbol>> alternatives = Alternatives();
+        if (next != items.size())
+            throw std::runtime_error("unexpected '" + items[next] + "' in rule '" + name + "'");
+
+        for (auto& rhs : alternatives)
+            productions.push_back({lhs, std::move(rhs)});
+    }
+
+    std::vector<std::vector<Symbol>> Alternatives()
+    {
+        std::vector<std::vector<Symbol>> result{Sequence()};
+        while (next < items.size() && items[next] == "|")
+        {
+            next++;
+            result.push_back(Sequence());
+        }
+        return result;
+    }
+
+    std::vector<Symbol> Sequence()
+    {
+        std::vector<Symbol> result;
+
+        while (next < items.size() && items[next] != "|" && items[next] != ")")
+        {
+            Symbol atom = Atom();
+
+            if (next < items.size() && (items[next] == "*" || items[next] == "?"))
+            {
+                // x*  →  h → x h | ε        x?  →  h → x | ε
+                bool repeat = items[next++] == "*";
+                size_t h = Helper();
+                productions.push_back({h, repeat ? std::vector<Symbol>{atom, {Symbol::NONTERMINAL, h}}
+                                                 : std::vector<Symbol>{atom}});
+                productions.push_back({h, {}});
+                atom = {Symbol::NONTERMINAL, h};
+            }
+
+            result.push_back(atom);
+        }
+
+        return result;
+    }
+
+    Symbol Atom()
+    {
+        const std::string& item = items[next++];
+
+        if (item == "(")
+        {
+            std::vector<std::vector<Symbol>> alternatives = Alternatives();
+            if (next == items.size() || items[next++] != ")")
+                throw std::runtime_error("missing ')' in rule '" + current + "'");
+
+            // ("+" | "-") matches one token of a set, so those tokens can
+            // share a column of the parse table
+            TokenSet set;
+            for (const auto& rhs : alternatives)
+                if (rhs.size() == 1 && rhs[0].kind == Symbol::TERMINAL)
+                    set.set(rhs[0].index);
+
+            if (set.count() == alternatives.size())
+            {
+                tokenSets.push_back(set);
+                return {Symbol::TOKEN_SET, tokenSets.size() - 1};
+            }
+
+            // ( a | b )  →  h → a | b
+            size_t h = Helper();
+            for (auto& rhs : alternatives)
+                productions.push_back({h, std::move(rhs)});
+            return {Symbol::NONTERMINAL, h};
+        }
+
+        if (item[0] == '"')
+        {
+            std::string spelling = item.substr(1, item.size() - 2);
+            for (const TokenName& t : TOKENS)
+                if (t.spelling && spelling == t.spelling)
+                    return {Symbol::TERMINAL, static_cast<size_t>(t.type)};
+            throw std::runtime_error("no token is spelled \"" + spelling + "\"");
+        }
+
+        if (item[0] == '@')
+        {
+            std::string name = item.substr(1);
+            auto [it, added] = actionIndex.emplace(name, actions.size());
+            if (added)
+                actions.push_back(name);
+            return {Symbol::ACTION, it->second};
+        }
+
+        if (std::isupper(static_cast<unsigned char>(item[0])))
+        {
+            std::string name = item == "EOF" ? "END_OF_FILE" : item;
+            for (const TokenName& t : TOKENS)
+                if (name == t.name)
+                    return {Symbol::TERMINAL, static_cast<size_t>(t.type)};
+            throw std::runtime_error("unknown token type " + item);
+        }
+
+        if (std::isalpha(static_cast<unsigned char>(item[0])))
+            return {Symbol::NONTERMINAL, Rule(item)};
+
+        throw std::runtime_error("unexpected '" + item + "' in rule '" + current + "'");
+    }
+
+    size_t Rule(const std::string& name)
+    {
+        auto [it, added] = ruleIndex.emplace(name, rules.size());
+        if (added)
+        {
+            rules.push_back(name);
+            origins.push_back(name);
+            defined.push_back(false);
+        }
+        return it->second;
+    }
+
+    // A fresh rule for a group or repetition inside 'current'
+    size_t Helper()
+    {
+        size_t h = Rule(current + "_" + std::to_string(++helpers[current]));
+        defined[h] = true;
+        origins[h] = current;
+        return h;
+    }
+
+    static std::vector<std::string> Split(const std::string& body)
+    {
+        std::vector<std::string> result;
+        size_t i = 0;
+
+        while (i < body.size())
+        {
+            char c = body[i];
+
+            if (std::isspace(static_cast<unsigned char>(c)))
+            {
+                i++;
+            }
+            else if (c == '"')
+            {
+                size_t end = body.find('"', i + 1);
+                if (end == std::string::npos)
+                    throw std::runtime_error("unterminated \" in grammar");
+                result.push_back(body.substr(i, end - i + 1));
+                i = end + 1;
+            }
+            else if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '@')
+            {
+                size_t start = i++;
+                while (i < body.size() &&
+                       (std::isalnum(static_cast<unsigned char>(body[i])) || body[i] == '_'))
+                    i++;
+                result.push_back(body.substr(start, i - start));
+            }
+            else
+            {
+                result.push_back(std::string(1, c));
+                i++;
+            }
+        }
+
+        return result;
+    }
+
+    static std::string Trim(const std::string& s)
+    {
+        size_t a = s.find_first_not_of(" \t");
+        size_t b = s.find_last_not_of(" \t");
+        return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+    }
+};
+
+// ---------- LL(1) analysis ----------
+
+class Analysis
+{
+public:
+    explicit Analysis(const Grammar& g)
+        : grammar(g),
+          nullable(g.rules.size(), false),
+          first(g.rules.size()),
+          follow(g.rules.size())
+    {
+        // Fixpoint over all productions until no set grows
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+
+            for (const Production& p : grammar.productions)
+            {
+                auto [set, empty] = FirstOf(p.rhs, 0);
+                changed |= Merge(first[p.lhs], set);
+                if (empty && !nullable[p.lhs])
+                    changed = nullable[p.lhs] = true;
+
+                for (size_t i = 0; i < p.rhs.size(); ++i)
+                {
+                    if (p.rhs[i].kind != Symbol::NONTERMINAL)
+                        continue;
+
+                    auto [rest, restEmpty] = FirstOf(p.rhs, i + 1);
+                    if (restEmpty)
+                        rest |= follow[p.lhs];
+                    changed |= Merge(follow[p.rhs[i].index], rest);
+                }
+            }
+        }
+    }
+
+    TokenSet Predict(const Production& p) const
+    {
+        auto [set, empty] = FirstOf(p.rhs, 0);
+        if (empty)
+            set |= follow[p.lhs];
+        return set;
+    }
+
+private:
+    const Grammar& grammar;
+    std::vector<bool> nullable;
+    std::vector<TokenSet> first;
+    std::vector<TokenSet> follow;
+
+    // FIRST of rhs[from..], and whether all of it can derive ε
+    std::pair<TokenSet, bool> FirstOf(const std::vector<Symbol>& rhs, size_t from) const
+    {
+        TokenSet set;
+
+        for (size_t i = from; i < rhs.size(); ++i)
+        {
+            const Symbol& s = rhs[i];
+            if (s.kind == Symbol::ACTION)
+                continue;
+
+            if (s.kind == Symbol::TERMINAL)
+            {
+                set.set(s.index);
+                return {set, false};
+            }
+
+            if (s.kind == Symbol::TOKEN_SET)
+            {
+                set |= grammar.tokenSets[s.index];
+                return {set, false};
+            }
+
+            set |= first[s.index];
+            if (!nullable[s.index])
+                return {set, false};
+        }
+
+        return {set, true};
+    }
+
+    static bool Merge(TokenSet& into, const TokenSet& from)
+    {
+        TokenSet before = into;
+        into |= from;
+        return into != before;
+    }
+};
+
+// ---------- Output ----------
+
+static std::string Describe(const Grammar& g, const Production& p)
+{
+    std::string s = g.rules[p.lhs] + " →";
+    for (const Symbol& sym : p.rhs)
+    {
+        if (sym.kind == Symbol::TERMINAL)
+        {
+            const TokenName& t = TOKENS[sym.index];
+            s += t.spelling ? std::string(" \"") + t.spelling + "\"" : std::string(" ") + t.name;
+        }
+        else if (sym.kind == Symbol::NONTERMINAL)
+            s += " " + g.rules[sym.index];
+        else if (sym.kind == Symbol::ACTION)
+            s += " @" + g.actions[sym.index];
+        else
+        {
+            std::string alternatives;
+            for (size_t t = 0; t < TOKEN_TYPES; ++t)
+                if (g.tokenSets[sym.index].test(t))
+                    alternatives += (alternatives.empty() ? "" : " | ") + std::string("\"") +
+                                    TOKENS[t].spelling + "\"";
+            s += " (" + alternatives + ")";
+        }
+    }
+    return p.rhs.empty() ? s + " ε" : s;
+}
+
+static bool SameSymbols(const std::vector<Symbol>& a, const std::vector<Symbol>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i].kind != b[i].kind || a[i].index != b[i].index)
+            return false;
+    return true;
+}
+
+static std::string Upper(std::string s)
+{
+    for (char& c : s)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return s;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <grammar>\n";
+        return 1;
+    }
+
+    std::ifstream file(argv[1]);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+
+    Grammar g;
+    try
+    {
+        g.Read(buffer.str());
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << argv[1] << ": " << e.what() << "\n";
+        return 1;
+    }
+
+    if (g.rules.size() > 0xff || g.actions.size() > 0xff || g.tokenSets.size() > 0xff ||
+        g.productions.size() > 0x7fff)
+    {
+        std::cerr << argv[1] << ": grammar too large for the table encoding\n";
+        return 1;
+    }
+
+    // ---------- Parse table ----------
+    Analysis analysis(g);
+    std::vector<std::vector<int>> table(g.rules.size(), std::vector<int>(TOKEN_TYPES, -1));
+    bool conflicts = false;
+
+    for (size_t p = 0; p < g.productions.size(); ++p)
+    {
+        const Production& prod = g.productions[p];
+        TokenSet predict = analysis.Predict(prod);
+
+        for (size_t t = 0; t < TOKEN_TYPES; ++t)
+        {
+            if (!predict.test(t))
+                continue;
+
+            int& cell = table[prod.lhs][t];
+            if (cell >= 0)
+            {
+                std::cerr << argv[1] << ": LL(1) conflict in '" << g.rules[prod.lhs]
+                          << "' on " << TOKENS[t].name << ":\n"
+                          << "    " << Describe(g, g.productions[cell]) << "\n"
+                          << "    " << Describe(g, prod) << "\n";
+                conflicts = true;
+                continue;
+            }
+            cell = static_cast<int>(p);
+        }
+    }
+
+    if (conflicts)
+        return 1;
+
+    // ---------- Token classes ----------
+    // Tokens whose column is identical in every row share one class
+    std::vector<std::vector<int>> classes;
+    std::vector<size_t> tokenClass(TOKEN_TYPES);
+
+    for (size_t t = 0; t < TOKEN_TYPES; ++t)
+    {
+        std::vector<int> column;
+        for (const auto& row : table)
+            column.push_back(row[t]);
+
+        size_t c = 0;
+        while (c < classes.size() && classes[c] != column)
+            c++;
+        if (c == classes.size())
+            classes.push_back(column);
+        tokenClass[t] = c;
+    }
+
+    // ---------- Expansions ----------
+    // The lookahead does not change while rules are expanded, so the chain
+    // a parser would go through for (rule, class) -- expression, equality,
+    // ..., primary -- is fixed. Each table entry is expanded here until a
+    // token (or a rule with no entry for that class, the error case) is
+    // the first non-action symbol, and the parser pushes it in one step.
+    std::vector<Production> expansions;
+    std::vector<std::vector<int>> expanded(g.rules.size(), std::vector<int>(classes.size(), -1));
+
+    for (size_t r = 0; r < g.rules.size(); ++r)
+    {
+        for (size_t c = 0; c < classes.size(); ++c)
+        {
+            if (classes[c][r] < 0)
+                continue;
+
+            std::vector<Symbol> seq = g.productions[classes[c][r]].rhs;
+
+            for (size_t steps = 0;; ++steps)
+            {
+                size_t i = 0;
+                while (i < seq.size() && seq[i].kind == Symbol::ACTION)
+                    i++;
+                if (i == seq.size() || seq[i].kind != Symbol::NONTERMINAL)
+                    break;
+
+                int p = classes[c][seq[i].index];
+                if (p < 0)
+                    break;
+
+                if (steps > 1000)
+                {
+                    std::cerr << argv[1] << ": rule '" << g.rules[r] << "' never reaches a token\n";
+                    return 1;
+                }
+
+                const std::vector<Symbol>& rhs = g.productions[p].rhs;
+                seq.erase(seq.begin() + i);
+                seq.insert(seq.begin() + i, rhs.begin(), rhs.end());
+            }
+
+            // Share identical expansions
+            size_t e = 0;
+            while (e < expansions.size() &&
+                   (expansions[e].lhs != r || !SameSymbols(expansions[e].rhs, seq)))
+                e++;
+            if (e == expansions.size())
+                expansions.push_back({r, std::move(seq)});
+            expanded[r][c] = static_cast<int>(e);
+        }
+    }
+
+    if (expansions.size() > 0x7fff)
+    {
+        std::cerr << argv[1] << ": grammar too large for the table encoding\n";
+        return 1;
+    }
+
+    // ---------- Header ----------
+    std::ostream& out = std::cout;
+
+    out << "// Generated by grammargen from '" << argv[1] << "'. Do not edit.\n"
+        << "#pragma once\n\n"
+        << "#include <cstddef>\n"
+        << "#include <cstdint>\n\n"
+        << "#include \"token.h\"\n\n"
+        << "namespace grammar\n{\n\n"
+        << "static_assert(static_cast<size_t>(TokenType::INVALID) + 1 == " << TOKEN_TYPES
+        << ", \"token.h changed; update TOKENS in grammargen.cpp\");\n\n";
+
+    out << "// A parse-stack symbol: kind in the high byte, index in the low byte\n"
+        << "inline constexpr uint16_t TERMINAL = 0x000;\n"
+        << "inline constexpr uint16_t NONTERMINAL = 0x100;\n"
+        << "inline constexpr uint16_t ACTION = 0x200;\n"
+        << "inline constexpr uint16_t TOKEN_SET = 0x300;\n\n";
+
+    out << "enum class Action : uint8_t\n{\n";
+    for (const std::string& a : g.actions)
+        out << "    " << Upper(a) << ",\n";
+    out << "};\n\n";
+
+    out << "inline constexpr size_t RULES = " << g.rules.size() << ";\n"
+        << "inline constexpr size_t CLASSES = " << classes.size() << ";\n"
+        << "inline constexpr uint16_t START = NONTERMINAL | 0;\n\n";
+
+    out << "// For error messages: helper rules report the rule they came from\n"
+        << "inline constexpr const char* RULE_NAMES[RULES] = {\n";
+    for (const std::string& r : g.origins)
+        out << "    \"" << r << "\",\n";
+    out << "};\n\n";
+
+    out << "// How each token appears in error messages\n"
+        << "inline constexpr const char* TOKEN_NAMES[] = {\n";
+    for (const TokenName& t : TOKENS)
+    {
+        if (t.spelling)
+            out << "    \"'" << t.spelling << "'\",\n";
+        else
+            out << "    \"" << t.name << "\",\n";
+    }
+    out << "};\n\n";
+
+    out << "// Column of PARSE_TABLE for each TokenType\n"
+        << "inline constexpr uint8_t TOKEN_CLASS[] = {\n";
+    for (size_t t = 0; t < TOKEN_TYPES; ++t)
+        out << "    " << tokenClass[t] << ", // " << TOKENS[t].name << "\n";
+    out << "};\n\n";
+
+    out << "// Bit t is set if TokenType t belongs to the set\n"
+        << "inline constexpr uint32_t TOKEN_SETS[] = {\n";
+    for (const TokenSet& set : g.tokenSets)
+        out << "    0x" << std::hex << set.to_ulong() << std::dec << ",\n";
+    out << "    0, // keeps the array non-empty\n"
+        << "};\n\n";
+
+    out << "// Table entries back to back, each stored last symbol first so it\n"
+        << "// can be pushed onto the parse stack as one block\n"
+        << "inline constexpr uint16_t SYMBOLS[] = {\n";
+    std::vector<size_t> offsets{0};
+    for (const Production& p : expansions)
+    {
+        out << "    ";
+        for (auto it = p.rhs.rbegin(); it != p.rhs.rend(); ++it)
+        {
+            const Symbol& s = *it;
+            if (s.kind == Symbol::TERMINAL)
+                out << "TERMINAL | " << s.index << ", ";
+            else if (s.kind == Symbol::NONTERMINAL)
+                out << "NONTERMINAL | " << s.index << ", ";
+            else if (s.kind == Symbol::ACTION)
+                out << "ACTION | " << s.index << ", ";
+            else
+                out << "TOKEN_SET | " << s.index << ", ";
+        }
+        out << "// " << offsets.size() - 1 << ": " << Describe(g, p) << "\n";
+        offsets.push_back(offsets.back() + p.rhs.size());
+    }
+    out << "    0, // keeps the array non-empty\n"
+        << "};\n\n";
+
+    out << "// Entry p is SYMBOLS[OFFSETS[p] .. OFFSETS[p + 1])\n"
+        << "inline constexpr uint16_t OFFSETS[] = {";
+    for (size_t i = 0; i < offsets.size(); ++i)
+        out << (i % 16 == 0 ? "\n    " : " ") << offsets[i] << ",";
+    out << "\n};\n\n";
+
+    out << "// Entry to push for (rule, token class); -1 is a syntax error\n"
+        << "inline constexpr int16_t PARSE_TABLE[RULES][CLASSES] = {\n";
+    for (size_t r = 0; r < g.rules.size(); ++r)
+    {
+        out << "    {";
+        for (size_t c = 0; c < classes.size(); ++c)
+            out << (c ? ", " : "") << expanded[r][c];
+        out << "}, // " << g.rules[r] << "\n";
+    }
+    out << "};\n\n"
+        << "} // namespace grammar\n";
+
+    return 0;
+}
@@ -0,0 +1,706 @@
+#pragma once
+
+#include "ast.h"
+#include "governor.h"
+#include "scopes.h"
+#include "value.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Static type of an IR value. Without control flow or input every value's
+// type is known while lowering, so type errors are found there too.
+enum class IrType : uint8_t
+{
+    NUMBER,
+    STRING,
+};
+
+// One SSA instruction. The result of instruction i is value %i, and every
+// operand refers to an earlier instruction.
+struct IrInstr
+{
+    enum Op : uint8_t
+    {
+        CONST,  // %i = constant
+        COPY,   // %i = %a            (x = y)
+        UNARY,  // %i = token %a
+        BINARY, // %i = %a token %b
+        PRINT,  // print %a
+        TRAP,   // fail with messages[a]; nothing after it runs
+    };
+
+    static constexpr uint32_t NO_NAME = UINT32_MAX;
+
+    Op op;
+    TokenType token = TokenType::INVALID; // UNARY, BINARY
+    IrType type = IrType::NUMBER;          // result of value instructions
+
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t name = NO_NAME; // variable version bound to this value, for dumps
+
+    Value constant = Value(); // CONST
+    uint64_t steps = 0;       // PRINT, TRAP: governor steps charged before it
+
+    bool HasResult() const
+    {
+        return op != PRINT && op != TRAP;
+    }
+};
+
+// SSA intermediate representation and optimizer.
+//
+// Lower() flattens the program into one straight-line instruction list.
+// Block scopes disappear: every 'var' and assignment binds the name to a
+// new value, so 'x' in different scopes or after reassignment becomes
+// x.1, x.2, ... and later reads refer to the value directly.
+//
+// Only PRINT and TRAP have effects. Every error the tree walker would
+// raise (undefined or redeclared names, operand types) is detected while
+// lowering and becomes a TRAP at that point, so all other instructions are
+// pure and total. That is what lets Optimize() delete and merge them
+// freely:
+//   - copy propagation: reads of a COPY read its source instead
+//   - common-subexpression elimination across statements and scopes
+//   - dead-code elimination: values no PRINT or TRAP depends on, which
+//     includes every store to a 'var' that is never read
+//
+// Steps are charged by the effects: each PRINT or TRAP carries the cost of
+// the source statements since the previous one, so step limits trip before
+// the same output as in the tree walker.
+//
+// Functions would need calls in the IR, and arrays a heap behind its
+// values; Lower() rejects programs that use either with UnsupportedProgram.
+class IrCompiler
+{
+private:
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor;
+
+    StringTable strings;
+
+    std::vector<IrInstr> code;
+    std::vector<std::string> messages; // TRAP texts
+
+    // Variable versions bound to values: names[i] is x.n, with x given by
+    // its ScopeTable id
+    struct Version
+    {
+        uint32_t name;
+        uint32_t n;
+    };
+    std::vector<Version> names;
+    uint64_t tailSteps = 0;            // charged after the last instruction
+
+    // Lowering state
+    ScopeTable<uint32_t> scopes;    // name -> value
+    std::vector<uint32_t> versions; // per name id, versions bound so far
+    uint64_t pendingSteps = 0; // source steps not yet charged by an effect
+    size_t nodes = 0;          // expression nodes visited by the last LowerExpr
+    bool trapped = false;      // lowering stopped at a TRAP
+
+    // Work and operand stacks for LowerExpr, as in the Interpreter
+    struct Work
+    {
+        enum Kind { VISIT, APPLY_UNARY, APPLY_BINARY };
+
+        const Expr* expr;
+        Kind kind;
+    };
+    std::vector<Work> work;
+    std::vector<uint32_t> operands;
+
+public:
+    // Instructions removed by each pass of the last Optimize()
+    struct Stats
+    {
+        size_t copies = 0;
+        size_t common = 0;
+        size_t dead = 0;
+    };
+
+    IrCompiler()
+        : governor(ownGovernor), strings(governor)
+    {
+    }
+
+    explicit IrCompiler(ResourceGovernor& g)
+        : governor(g), strings(governor)
+    {
+    }
+
+    void Lower(const std::vector<std::unique_ptr<Stmt>>& statements)
+    {
+        // Every call, return and call statement needs a declared function
+        for (const auto& stmt : statements)
+            if (dynamic_cast<const FunctionStmt*>(stmt.get()))
+                throw UnsupportedProgram("Functions are not supported by the IR");
+
+        struct Frame
+        {
+            const std::vector<std::unique_ptr<Stmt>>* statements;
+            size_t next;
+        };
+
+        std::vector<Frame> frames{{&statements, 0}};
+        scopes.Reset();
+
+        while (!frames.empty() && !trapped)
+        {
+            Frame& frame = frames.back();
+
+            if (frame.next == frame.statements->size())
+            {
+                frames.pop_back();
+                if (!frames.empty())
+                    scopes.PopScope();
+                continue;
+            }
+
+            const Stmt* stmt = (*frame.statements)[frame.next++].get();
+
+            if (auto block = dynamic_cast<const BlockStmt*>(stmt))
+            {
+                pendingSteps++;
+                scopes.PushScope();
+                frames.push_back({&block->statements, 0});
+                continue;
+            }
+
+            LowerStmt(stmt);
+        }
+
+        if (!trapped)
+            tailSteps = pendingSteps;
+    }
+
+    Stats Optimize()
+    {
+        Stats stats;
+        stats.copies = PropagateCopies();
+        stats.common = EliminateCommonSubexpressions();
+        stats.dead = EliminateDeadCode();
+        return stats;
+    }
+
+    void Execute()
+    {
+        governor.Charge(code.size() * sizeof(Value));
+        std::vector<Value> values(code.size());
+
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            const IrInstr& in = code[i];
+
+            switch (in.op)
+            {
+            case IrInstr::CONST:
+                values[i] = in.constant;
+                break;
+
+            case IrInstr::COPY:
+                values[i] = values[in.a];
+                break;
+
+            case IrInstr::UNARY:
+                values[i] = ApplyUnary(in.token, values[in.a]);
+                break;
+
+            case IrInstr::BINARY:
+                values[i] = ApplyBinary(in.token, values[in.a], values[in.b], strings);
+                break;
+
+            case IrInstr::PRINT:
+                governor.Step(in.steps);
+                PrintValue(std::cout, values[in.a]);
+                std::cout << std::endl;
+                break;
+
+            case IrInstr::TRAP:
+                governor.Step(in.steps);
+                throw std::runtime_error(messages[in.a]);
+            }
+        }
+
+        if (tailSteps > 0)
+            governor.Step(tailSteps);
+    }
+
+    void Dump(std::ostream& out) const
+    {
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            const IrInstr& in = code[i];
+
+            if (in.HasResult())
+                out << "%" << i << " = ";
+
+            switch (in.op)
+            {
+            case IrInstr::CONST:
+                out << "const ";
+                if (in.constant.IsString())
+                    out << '"' << in.constant.AsString() << '"';
+                else
+                    out << in.constant.AsNumber();
+                break;
+
+            case IrInstr::COPY:
+                out << "copy %" << in.a;
+                break;
+
+            case IrInstr::UNARY:
+                out << "neg %" << in.a;
+                break;
+
+            case IrInstr::BINARY:
+                out << Mnemonic(in.token) << " %" << in.a << ", %" << in.b;
+                break;
+
+            case IrInstr::PRINT:
+                out << "print %" << in.a;
+                break;
+
+            case IrInstr::TRAP:
+                out << "trap \"" << messages[in.a] << '"';
+                break;
+            }
+
+            if (in.name != IrInstr::NO_NAME)
+                out << "  ; " << scopes.Name(names[in.name].name) << '.' << names[in.name].n;
+            else if (!in.HasResult())
+                out << "  ; steps " << in.steps;
+            out << "\n";
+        }
+
+        if (tailSteps > 0)
+            out << "; steps " << tailSteps << "\n";
+    }
+
+private:
+    // ---------------- LOWERING ----------------
+
+    void LowerStmt(const Stmt* stmt)
+    {
+        uint64_t stepsBefore = pendingSteps + 1;
+
+        // Assignment: x = expression
+        if (auto assign = dynamic_cast<const AssignStmt*>(stmt))
+        {
+            std::optional<uint32_t> value = LowerExpr(assign->value.get(), stepsBefore);
+            if (!value)
+                return;
+
+            uint32_t* binding = scopes.Find(assign->name);
+            if (!binding)
+                return Trap(stepsBefore + nodes, "Undefined variable: " + assign->name);
+
+            *binding = Bind(assign->name, assign->value.get(), *value);
+            pendingSteps = stepsBefore + nodes;
+            return;
+        }
+
+        if (auto varDecl = dynamic_cast<const VarDeclStmt*>(stmt))
+        {
+            std::optional<uint32_t> value = LowerExpr(varDecl->initializer.get(), stepsBefore);
+            if (!value)
+                return;
+
+            if (scopes.DeclaredInScope(varDecl->name))
+                return Trap(stepsBefore + nodes,
+                            "Variable already declared in this scope: " + varDecl->name);
+
+            scopes.Declare(varDecl->name, Bind(varDecl->name, varDecl->initializer.get(), *value));
+            pendingSteps = stepsBefore + nodes;
+            return;
+        }
+
+        // Print: print expression
+        if (auto print = dynamic_cast<const PrintStmt*>(stmt))
+        {
+            std::optional<uint32_t> value = LowerExpr(print->value.get(), stepsBefore);
+            if (!value)
+                return;
+
+            IrInstr in{IrInstr::PRINT};
+            in.a = *value;
+            in.steps = stepsBefore + nodes;
+            Emit(in);
+            pendingSteps = 0;
+            return;
+        }
+
+        // Stores, and builtins called on their own
+        if (dynamic_cast<const IndexAssignStmt*>(stmt) || dynamic_cast<const ExprStmt*>(stmt))
+            throw UnsupportedProgram("Arrays are not supported by the IR");
+
+        throw std::runtime_error("Unknown statement type");
+    }
+
+    // Emits the instructions of 'expr' and returns its value, or emits a
+    // TRAP and returns nothing if evaluating it would fail. 'stepsBefore'
+    // is what the statement has charged before its first node.
+    std::optional<uint32_t> LowerExpr(const Expr* expr, uint64_t stepsBefore)
+    {
+        nodes = 0;
+        work.clear();
+        operands.clear();
+
+        work.push_back({expr, Work::VISIT});
+
+        while (!work.empty())
+        {
+            Work item = work.back();
+            work.pop_back();
+
+            // Binary operation, both operands lowered
+            if (item.kind == Work::APPLY_BINARY)
+            {
+                auto bin = static_cast<const BinaryExpr*>(item.expr);
+                uint32_t right = operands.back();
+                operands.pop_back();
+                uint32_t left = operands.back();
+
+                const char* error = BinaryError(bin->op, code[left].type, code[right].type);
+                if (error)
+                {
+                    Trap(stepsBefore + nodes, error);
+                    return std::nullopt;
+                }
+
+                IrInstr in{IrInstr::BINARY};
+                in.token = bin->op;
+                in.a = left;
+                in.b = right;
+                in.type = BinaryType(bin->op, code[left].type, code[right].type);
+                operands.back() = Emit(in);
+                continue;
+            }
+
+            // Unary operation, operand lowered
+            if (item.kind == Work::APPLY_UNARY)
+            {
+                auto unary = static_cast<const UnaryExpr*>(item.expr);
+                if (code[operands.back()].type != IrType::NUMBER)
+                {
+                    Trap(stepsBefore + nodes, "Operand must be a number");
+                    return std::nullopt;
+                }
+
+                IrInstr in{IrInstr::UNARY};
+                in.token = unary->op;
+                in.a = operands.back();
+                operands.back() = Emit(in);
+                continue;
+            }
+
+            nodes++;
+
+            // Number literal
+            if (auto num = dynamic_cast<const NumberExpr*>(item.expr))
+            {
+                IrInstr in{IrInstr::CONST};
+                in.constant = Value::Number(num->value);
+                operands.push_back(Emit(in));
+                continue;
+            }
+
+            // Variable reference: the value itself, no instruction
+            if (auto var = dynamic_cast<const VariableExpr*>(item.expr))
+            {
+                uint32_t* binding = scopes.Find(var->name);
+                if (!binding)
+                {
+                    Trap(stepsBefore + nodes, "Undefined variable: " + var->name);
+                    return std::nullopt;
+                }
+
+                operands.push_back(*binding);
+                continue;
+            }
+
+            // Binary operation: left is evaluated first
+            if (auto bin = dynamic_cast<const BinaryExpr*>(item.expr))
+            {
+                work.push_back({bin, Work::APPLY_BINARY});
+                work.push_back({bin->right.get(), Work::VISIT});
+                work.push_back({bin->left.get(), Work::VISIT});
+                continue;
+            }
+
+            if (auto unary = dynamic_cast<const UnaryExpr*>(item.expr))
+            {
+                work.push_back({unary, Work::APPLY_UNARY});
+                work.push_back({unary->operand.get(), Work::VISIT});
+                continue;
+            }
+
+            // String literal, interned once here
+            if (auto str = dynamic_cast<const StringExpr*>(item.expr))
+            {
+                IrInstr in{IrInstr::CONST};
+                in.constant = strings.Intern(str->value);
+                in.type = IrType::STRING;
+                operands.push_back(Emit(in));
+                continue;
+            }
+
+            // Every call left here is to a builtin, and they all take arrays
+            if (dynamic_cast<const ArrayExpr*>(item.expr) || dynamic_cast<const IndexExpr*>(item.expr) ||
+                dynamic_cast<const CallExpr*>(item.expr))
+                throw UnsupportedProgram("Arrays are not supported by the IR");
+
+            throw std::runtime_error("Unknown expression type");
+        }
+
+        return operands.back();
+    }
+
+    // The value a 'var' or assignment binds to 'name'. A fresh result is
+    // simply labelled; reading another variable (x = y) is a COPY, which
+    // PropagateCopies() removes again.
+    uint32_t Bind(const std::string& name, const Expr* expr, uint32_t value)
+    {
+        if (dynamic_cast<const VariableExpr*>(expr))
+        {
+            IrInstr in{IrInstr::COPY};
+            in.a = value;
+            in.type = code[value].type;
+            value = Emit(in);
+        }
+
+        uint32_t id = scopes.Id(name);
+        if (id >= versions.size())
+            versions.resize(id + 1, 0);
+
+        code[value].name = static_cast<uint32_t>(names.size());
+        names.push_back({id, ++versions[id]});
+        return value;
+    }
+
+    void Trap(uint64_t steps, std::string message)
+    {
+        IrInstr in{IrInstr::TRAP};
+        in.a = static_cast<uint32_t>(messages.size());
+        in.steps = steps;
+        messages.push_back(std::move(message));
+        Emit(in);
+        trapped = true;
+    }
+
+    uint32_t Emit(const IrInstr& in)
+    {
+        if (code.size() >= IrInstr::NO_NAME)
+            throw std::runtime_error("Program too large for the IR");
+
+        governor.Charge(sizeof(IrInstr));
+        code.push_back(in);
+        return static_cast<uint32_t>(code.size() - 1);
+    }
+
+    // ---------------- PASSES ----------------
+
+    // Each pass maps some values to an equivalent earlier value; Rewrite()
+    // then redirects every operand. Operands always point backwards, so a
+    // single forward sweep resolves chains.
+    void Rewrite(std::vector<uint32_t>& replace)
+    {
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            IrInstr& in = code[i];
+            in.a = (in.op == IrInstr::CONST || in.op == IrInstr::TRAP) ? in.a : replace[in.a];
+            if (in.op == IrInstr::BINARY)
+                in.b = replace[in.b];
+            replace[i] = replace[replace[i]];
+        }
+    }
+
+    std::vector<uint32_t> Identity() const
+    {
+        std::vector<uint32_t> replace(code.size());
+        for (size_t i = 0; i < code.size(); ++i)
+            replace[i] = static_cast<uint32_t>(i);
+        return replace;
+    }
+
+    size_t PropagateCopies()
+    {
+        std::vector<uint32_t> replace = Identity();
+        size_t count = 0;
+
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (code[i].op == IrInstr::COPY)
+            {
+                replace[i] = code[i].a;
+                count++;
+            }
+        }
+
+        Rewrite(replace);
+        return count;
+    }
+
+    // Values are immutable and every instruction is pure, so two
+    // instructions with the same operator and operands are the same value
+    // wherever they appear.
+    size_t EliminateCommonSubexpressions()
+    {
+        struct Key
+        {
+            IrInstr::Op op;
+            TokenType token;
+            uint32_t a, b;
+            uint64_t bits;
+
+            bool operator==(const Key& k) const
+            {
+                return op == k.op && token == k.token && a == k.a && b == k.b && bits == k.bits;
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& k) const
+            {
+                uint64_t h = k.bits;
+                h = h * 0x9e3779b97f4a7c15 + k.a;
+                h = h * 0x9e3779b97f4a7c15 + k.b;
+                h = h * 0x9e3779b97f4a7c15 + (uint64_t(k.op) << 8 | uint64_t(k.token));
+                return static_cast<size_t>(h ^ (h >> 29));
+            }
+        };
+
+        std::unordered_map<Key, uint32_t, KeyHash> seen;
+        std::vector<uint32_t> replace = Identity();
+        size_t count = 0;
+
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            IrInstr& in = code[i];
+            if (in.op != IrInstr::CONST && in.op != IrInstr::UNARY && in.op != IrInstr::BINARY)
+                continue;
+
+            // Operands may have been replaced earlier in this sweep
+            uint32_t a = in.op == IrInstr::CONST ? 0 : replace[in.a];
+            uint32_t b = in.op == IrInstr::BINARY ? replace[in.b] : 0;
+            uint64_t bits = in.op == IrInstr::CONST ? in.constant.Bits() : 0;
+
+            auto [it, added] = seen.emplace(Key{in.op, in.token, a, b, bits}, static_cast<uint32_t>(i));
+            if (!added)
+            {
+                replace[i] = it->second;
+                count++;
+            }
+        }
+
+        Rewrite(replace);
+        return count;
+    }
+
+    // Keeps effects and what they use, then renumbers the survivors
+    size_t EliminateDeadCode()
+    {
+        std::vector<bool> live(code.size(), false);
+
+        for (size_t i = code.size(); i-- > 0;)
+        {
+            const IrInstr& in = code[i];
+            if (!in.HasResult())
+                live[i] = true;
+            if (!live[i])
+                continue;
+
+            if (in.op == IrInstr::COPY || in.op == IrInstr::UNARY ||
+                in.op == IrInstr::BINARY || in.op == IrInstr::PRINT)
+                live[in.a] = true;
+            if (in.op == IrInstr::BINARY)
+                live[in.b] = true;
+        }
+
+        std::vector<uint32_t> renumber(code.size());
+        size_t kept = 0;
+
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (!live[i])
+                continue;
+
+            IrInstr in = code[i];
+            if (in.op != IrInstr::CONST && in.op != IrInstr::TRAP)
+                in.a = renumber[in.a];
+            if (in.op == IrInstr::BINARY)
+                in.b = renumber[in.b];
+
+            renumber[i] = static_cast<uint32_t>(kept);
+            code[kept++] = in;
+        }
+
+        size_t removed = code.size() - kept;
+        code.resize(kept);
+        governor.Release(removed * sizeof(IrInstr));
+        return removed;
+    }
+
+    // ---------------- TYPES ----------------
+
+    // The error ApplyBinary would throw for these operand types, if any
+    // (see MixedBinary)
+    static const char* BinaryError(TokenType op, IrType left, IrType right)
+    {
+        if (left == IrType::NUMBER && right == IrType::NUMBER)
+            return nullptr;
+
+        switch (op)
+        {
+        case TokenType::PLUS:
+        case TokenType::EQUAL_EQUAL:
+        case TokenType::NOT_EQUAL:
+            return nullptr;
+
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+            if (left == IrType::STRING && right == IrType::STRING)
+                return nullptr;
+            return "Operands must be two numbers or two strings";
+
+        default:
+            return "Operands must be numbers";
+        }
+    }
+
+    static IrType BinaryType(TokenType op, IrType left, IrType right)
+    {
+        if (op == TokenType::PLUS && (left == IrType::STRING || right == IrType::STRING))
+            return IrType::STRING;
+        return IrType::NUMBER;
+    }
+
+    static const char* Mnemonic(TokenType op)
+    {
+        switch (op)
+        {
+        case TokenType::PLUS:          return "add";
+        case TokenType::MINUS:         return "sub";
+        case TokenType::STAR:          return "mul";
+        case TokenType::SLASH:         return "div";
+        case TokenType::EQUAL_EQUAL:   return "eq";
+        case TokenType::NOT_EQUAL:     return "ne";
+        case TokenType::LESS:          return "lt";
+        case TokenType::LESS_EQUAL:    return "le";
+        case TokenType::GREATER:       return "gt";
+        case TokenType::GREATER_EQUAL: return "ge";
+        default:                       return "?";
+        }
+    }
+};
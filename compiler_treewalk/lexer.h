@@ -1,41 +1,74 @@
+#pragma once
+
 #include <string>
+#include <string_view>
 #include <vector>
-#include <cctype>
-#include <vector>
+#include <charconv>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
 #include "token.h"
+#include "governor.h"
 
 using namespace std;
 
 
+// Tokens are (offset, length) spans into 'source', so the source text must
+// outlive the returned TokenStream.
+//
+// Everything is constexpr, so a script literal can be tokenized during
+// constant evaluation (see compiletime.h).
 class Lexer
 {
 private:
-    std::string source;
+    std::string_view source;
     size_t current;
 
+    TokenStream tokens;
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor; // only the deadline applies to lexing
+
 public:
-    Lexer(const std::string& src)
-        : source(src), current(0)
+    constexpr Lexer(std::string_view src)
+        : source(src), current(0), governor(ownGovernor)
+    {
+    }
+
+    constexpr Lexer(std::string_view src, ResourceGovernor& g)
+        : source(src), current(0), governor(g)
     {
     }
 
-    std::vector<Token> Tokenize()
+    constexpr TokenStream Tokenize()
     {
-        std::vector<Token> tokens;
+        if (source.size() > UINT32_MAX)
+            throw std::runtime_error("Source file too large");
+
+        tokens = TokenStream{};
+        tokens.source = source;
+
+        // Most tokens are a few characters long; avoid regrowing
+        tokens.types.reserve(source.size() / 3 + 1);
+        tokens.spans.reserve(source.size() / 3 + 1);
+
         bool lastWasNewline = false;
 
         while (!IsAtEnd())
         {
+            size_t start = current;
             char c = Advance();
 
             // Whitespace handling
-            if (std::isspace(c))
+            if (IsSpace(c))
             {
                 if (c == '\n')
                 {
                     if (!lastWasNewline)
                     {
-                        tokens.push_back({TokenType::NEWLINE, "\\n"});
+                        governor.PollDeadline();
+                        tokens.Push(TokenType::NEWLINE, start, 1);
                         lastWasNewline = true;
                     }
                 }
@@ -47,157 +80,240 @@ public:
             // String literal
             if (c == '"')
             {
-                tokens.push_back(StringLiteral());
+                StringLiteral(start);
             }
             // Identifier or keyword
-            else if (std::isalpha(c) || c == '_')
+            else if (IsAlpha(c) || c == '_')
             {
-                tokens.push_back(Identifier(c));
+                Identifier(start);
             }
             // Number
-            else if (std::isdigit(c))
+            else if (IsDigit(c))
             {
-                tokens.push_back(Number(c));
+                Number(start);
             }
             // Operators / symbols
             else
             {
-                tokens.push_back(Symbol(c));
+                Symbol(start, c);
             }
         }
 
-        tokens.push_back({TokenType::END_OF_FILE, ""});
-        return tokens;
+        tokens.Push(TokenType::END_OF_FILE, current, 0);
+        return std::move(tokens);
     }
 
 private:
-    bool IsAtEnd() const
+    constexpr bool IsAtEnd() const
     {
         return current >= source.size();
     }
 
-    char Advance()
+    constexpr char Advance()
     {
         return source[current++];
     }
 
-    char Peek() const
+    constexpr char Peek() const
     {
         if (IsAtEnd())
             return '\0';
         return source[current];
     }
 
-    // ---------- Token scanners ----------
+    // ---------- Character classes ----------
+    // ASCII only, like <cctype> in the "C" locale, but usable in constexpr
 
-    Token Identifier(char first)
+    static constexpr bool IsSpace(char c)
     {
-        std::string value(1, first);
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
 
-        while (std::isalnum(Peek()) || Peek() == '_')
-            value += Advance();
+    static constexpr bool IsDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
 
-        if (value == "print")
-            return {TokenType::PRINT, value};
-        
-        if (value == "var")
-            return {TokenType::VAR, value};
+    static constexpr bool IsAlpha(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    // ---------- Number decoding ----------
+
+    // Clinger's fast path: when the digits form an integer of at most 2^53
+    // and there are at most 22 fraction digits, both the integer and the
+    // power of ten are exact doubles, and one correctly rounded division
+    // gives the same result as from_chars. Anything else needs from_chars,
+    // which is not available during constant evaluation.
+    static constexpr double DecodeNumber(std::string_view text)
+    {
+        constexpr double POWERS[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                     1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                     1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        constexpr uint64_t EXACT = uint64_t(1) << 53;
+
+        uint64_t mantissa = 0;
+        size_t fraction = 0;
+        bool dot = false;
+        bool exact = true;
 
-        return {TokenType::IDENTIFIER, value};
+        for (char c : text)
+        {
+            if (c == '.')
+            {
+                dot = true;
+                continue;
+            }
+
+            fraction += dot;
+            mantissa = mantissa * 10 + (c - '0');
+            if (mantissa > EXACT)
+            {
+                exact = false;
+                break;
+            }
+        }
+
+        if (exact && fraction < std::size(POWERS))
+            return static_cast<double>(mantissa) / POWERS[fraction];
+
+        if (std::is_constant_evaluated())
+            throw std::runtime_error("Number literal too precise for constant evaluation");
+
+        double value = 0;
+        std::from_chars(text.data(), text.data() + text.size(), value);
+        return value;
     }
 
-    Token Number(char first)
+    // ---------- Token scanners ----------
+
+    constexpr void Identifier(size_t start)
     {
-        std::string value(1, first);
+        while (IsAlpha(Peek()) || IsDigit(Peek()) || Peek() == '_')
+            Advance();
+
+        std::string_view value = source.substr(start, current - start);
+
+        if (value == "print")
+            tokens.Push(TokenType::PRINT, start, current - start);
+        else if (value == "var")
+            tokens.Push(TokenType::VAR, start, current - start);
+        else if (value == "fn")
+            tokens.Push(TokenType::FN, start, current - start);
+        else if (value == "return")
+            tokens.Push(TokenType::RETURN, start, current - start);
+        else
+            tokens.Push(TokenType::IDENTIFIER, start, current - start);
+    }
 
-        while (std::isdigit(Peek()))
-            value += Advance();
+    constexpr void Number(size_t start)
+    {
+        while (IsDigit(Peek()))
+            Advance();
 
         if (Peek() == '.')
         {
-            value += Advance();
-            while (std::isdigit(Peek()))
-                value += Advance();
+            Advance();
+            while (IsDigit(Peek()))
+                Advance();
         }
 
-        return {TokenType::NUMBER, value};
+        // Decode once here; the parser reads tokens.numbers in order
+        double value = DecodeNumber(source.substr(start, current - start));
+
+        tokens.Push(TokenType::NUMBER, start, current - start);
+        tokens.numbers.push_back(value);
     }
 
-    Token StringLiteral()
+    // The span covers the contents only, without the quotes
+    constexpr void StringLiteral(size_t start)
     {
-        std::string value;
-
         while (!IsAtEnd() && Peek() != '"')
         {
             // strings cannot span lines in this language
             if (Peek() == '\n')
-                return {TokenType::INVALID, "Unterminated string"};
+            {
+                tokens.Push(TokenType::INVALID, start, current - start);
+                return;
+            }
 
-            value += Advance();
+            Advance();
         }
 
         if (IsAtEnd())
-            return {TokenType::INVALID, "Unterminated string"};
+        {
+            tokens.Push(TokenType::INVALID, start, current - start);
+            return;
+        }
 
         Advance(); // consume closing "
 
-        return {TokenType::STRING, value};
+        tokens.Push(TokenType::STRING, start + 1, current - start - 2);
+    }
+
+    constexpr void Symbol(size_t start, char c)
+    {
+        TokenType type = SymbolType(c); // may consume a second character
+        tokens.Push(type, start, current - start);
     }
 
-    Token Symbol(char c)
+    constexpr TokenType SymbolType(char c)
     {
       switch (c)
       {
         case '{':
-    return{TokenType::LBRACE, "{"};
+    return TokenType::LBRACE;
     break;
 
     case '}':
-    return {TokenType::RBRACE, "}"};
+    return TokenType::RBRACE;
     break;
 
-          case '(': return {TokenType::LPAREN, "("};
-          case ')': return {TokenType::RPAREN, ")"};
-          case '+': return {TokenType::PLUS, "+"};
-          case '-': return {TokenType::MINUS, "-"};
-          case '*': return {TokenType::STAR, "*"};
-          case '/': return {TokenType::SLASH, "/"};
+          case '(': return TokenType::LPAREN;
+          case ')': return TokenType::RPAREN;
+          case '[': return TokenType::LBRACKET;
+          case ']': return TokenType::RBRACKET;
+          case ',': return TokenType::COMMA;
+          case '+': return TokenType::PLUS;
+          case '-': return TokenType::MINUS;
+          case '*': return TokenType::STAR;
+          case '/': return TokenType::SLASH;
 
           case '=':
               if (Peek() == '=')
               {
                   Advance();
-                  return {TokenType::EQUAL_EQUAL, "=="};
+                  return TokenType::EQUAL_EQUAL;
               }
-              return {TokenType::ASSIGN, "="};
+              return TokenType::ASSIGN;
 
           case '!':
               if (Peek() == '=')
               {
                   Advance();
-                  return {TokenType::NOT_EQUAL, "!="};
+                  return TokenType::NOT_EQUAL;
               }
-              return {TokenType::INVALID, "!"};
+              return TokenType::INVALID;
 
           case '<':
               if (Peek() == '=')
               {
                   Advance();
-                  return {TokenType::LESS_EQUAL, "<="};
+                  return TokenType::LESS_EQUAL;
               }
-              return {TokenType::LESS, "<"};
+              return TokenType::LESS;
 
           case '>':
               if (Peek() == '=')
               {
                   Advance();
-                  return {TokenType::GREATER_EQUAL, ">="};
+                  return TokenType::GREATER_EQUAL;
               }
-              return {TokenType::GREATER, ">"};
+              return TokenType::GREATER;
 
           default:
-              return {TokenType::INVALID, std::string(1, c)};
+              return TokenType::INVALID;
         }
     }
 };
-
@@ -1,52 +1,213 @@
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 
 #include "lexer.h"
 #include "parser.h"
+#include "table_parser.h"
 #include "treewalk.h"
+#include "closure.h"
+#include "ir.h"
+#include "snapshot.h"
 #include "token.h"
+#include "governor.h"
 
 // Debug helper (you already asked for this earlier)
 //const char* TokenTypeToString(TokenType type);
 
+// The value of a limit flag: a whole number above zero
+static uint64_t PositiveLimit(const char* text)
+{
+    size_t used = 0;
+    long long value = std::stoll(text, &used);
+    if (text[used] != '\0' || value <= 0)
+        throw std::invalid_argument(text);
+    return static_cast<uint64_t>(value);
+}
+
+static int Usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [options] <source-file>\n"
+              << "  --max-steps N      abort after N statements/expressions\n"
+              << "  --max-memory BYTES abort when AST + scopes exceed BYTES\n"
+              << "  --timeout MS       abort after MS milliseconds of wall clock\n"
+              << "  --table-parser     parse with the tables generated from 'grammar'\n"
+              << "  --closures         compile to closures before running\n"
+              << "  --ir               run through the optimized SSA IR\n"
+              << "  --dump-ir          print the optimized SSA IR instead of running\n"
+              << "  --snapshot FILE    save the global variables after running\n"
+              << "  --restore FILE     resume from a snapshot whose script this one extends\n";
+    return 1;
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc < 2)
+    // ---------- Command line ----------
+    ResourceGovernor::Limits limits;
+    const char* path = nullptr;
+    bool tableParser = false;
+    bool closures = false;
+    bool ir = false;
+    bool dumpIr = false;
+    std::string snapshotPath;
+    std::string restorePath;
+
+    try
     {
-        std::cerr << "Usage: " << argv[0] << " <source-file>\n";
-        return 1;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if (arg == "--max-steps" && i + 1 < argc)
+                limits.maxSteps = PositiveLimit(argv[++i]);
+            else if (arg == "--max-memory" && i + 1 < argc)
+                limits.maxMemory = PositiveLimit(argv[++i]);
+            else if (arg == "--timeout" && i + 1 < argc)
+                limits.timeout = std::chrono::milliseconds(PositiveLimit(argv[++i]));
+            else if (arg == "--table-parser")
+                tableParser = true;
+            else if (arg == "--closures")
+                closures = true;
+            else if (arg == "--ir")
+                ir = true;
+            else if (arg == "--dump-ir")
+                dumpIr = true;
+            else if (arg == "--snapshot" && i + 1 < argc)
+                snapshotPath = argv[++i];
+            else if (arg == "--restore" && i + 1 < argc)
+                restorePath = argv[++i];
+            else if (arg.rfind("--", 0) == 0 || path)
+                return Usage(argv[0]);
+            else
+                path = argv[i];
+        }
+    }
+    catch (const std::exception&)
+    {
+        return Usage(argv[0]);
     }
 
+    if (!path)
+        return Usage(argv[0]);
+
+    // Snapshots hold tree-walker state
+    if ((!snapshotPath.empty() || !restorePath.empty()) && (closures || ir || dumpIr))
+        return Usage(argv[0]);
+
+    ResourceGovernor governor(limits);
+
     // ---------- Read source file ----------
-    std::ifstream file(argv[1]);
+    std::ifstream file(path);
     std::stringstream buffer;
     buffer << file.rdbuf();
     std::string source = buffer.str();
 
-    // ---------- Lexing ----------
-    Lexer lexer(source);
-    std::vector<Token> tokens = lexer.Tokenize();
-
-    // ---------- Token dump (VERY IMPORTANT for debugging) ----------
-    //for (size_t i = 0; i < tokens.size(); ++i)
-    //{
-    //    std::cout << i << ": "
-    //              << TokenTypeToString(tokens[i].type)
-    //              << " [" << tokens[i].lexeme << "]\n";
-    //}
-    //std::cout << "---------------------\n";
-
     try
     {
+        // Declared first: the interpreter reads its globals until the end
+        std::unique_ptr<MappedSnapshot> snapshot;
+        Interpreter interpreter(governor);
+
+        // ---------- Warm start ----------
+        // Only the part of the script after the snapshot's prelude is run
+        size_t resume = 0;
+        if (!restorePath.empty())
+        {
+            snapshot = std::make_unique<MappedSnapshot>(restorePath);
+            resume = snapshot->Restore(interpreter, source);
+        }
+
+        // ---------- Lexing ----------
+        Lexer lexer(std::string_view(source).substr(resume), governor);
+        TokenStream tokens = lexer.Tokenize();
+
+        // ---------- Token dump (VERY IMPORTANT for debugging) ----------
+        //for (size_t i = 0; i < tokens.Size(); ++i)
+        //{
+        //    std::cout << i << ": "
+        //              << TokenTypeToString(tokens.types[i])
+        //              << " [" << tokens.Lexeme(i) << "]\n";
+        //}
+        //std::cout << "---------------------\n";
+
         // ---------- Parsing ----------
-        Parser parser(tokens);
-        std::vector<std::unique_ptr<Stmt>> program = parser.ParseProgram();
+        std::vector<std::unique_ptr<Stmt>> program = tableParser
+            ? TableParser(tokens, governor).ParseProgram()
+            : Parser(tokens, governor).ParseProgram();
+
+        if (!snapshotPath.empty())
+            CheckSnapshotProgram(program);
+
+        // ---------- SSA IR ----------
+        if (ir || dumpIr)
+        {
+            try
+            {
+                IrCompiler compiler(governor);
+                compiler.Lower(program);
+                IrCompiler::Stats stats = compiler.Optimize();
+
+                if (dumpIr)
+                {
+                    std::cout << "; removed " << stats.copies << " copies, "
+                              << stats.common << " common subexpressions, "
+                              << stats.dead << " dead values\n";
+                    compiler.Dump(std::cout);
+                    return 0;
+                }
+
+                compiler.Execute();
+                return 0;
+            }
+            catch (const UnsupportedProgram&)
+            {
+                // As for closures below; there is no IR to dump, though
+                if (dumpIr)
+                    throw;
+            }
+        }
+
+        // ---------- Closure compilation ----------
+        if (closures)
+        {
+            try
+            {
+                ClosureCompiler compiler(governor);
+                compiler.Compile(program);
+                compiler.Execute();
+                return 0;
+            }
+            catch (const UnsupportedProgram&)
+            {
+                // Nothing has run yet; the tree walker handles everything
+            }
+        }
 
         // ---------- Interpretation ----------
-        Interpreter interpreter;
         interpreter.Execute(program);
+
+        if (!snapshotPath.empty())
+            SaveSnapshot(snapshotPath, interpreter, source);
+    }
+    // Budget violations get their own exit codes so a supervisor can tell
+    // them apart from ordinary script errors.
+    catch (const StepLimitError& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 2;
+    }
+    catch (const MemoryLimitError& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 3;
+    }
+    catch (const DeadlineError& e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 4;
     }
     catch (const std::exception& e)
     {
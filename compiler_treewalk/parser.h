@@ -2,29 +2,103 @@
 
 #include "token.h"
 #include "ast.h"
+#include "governor.h"
+#include "resolver.h"
 
 #include <vector>
 #include <memory>
 #include <stdexcept>
 #include <cstdlib>
+#include <cstdint>
+
+// ================= BINDING POWERS =================
+//
+// One row per operator token. Infix operators bind their left operand
+// with 'left' and their right operand with 'right'; right = left + 1
+// makes them left-associative. 'prefix' is the binding power of the
+// operator used as a unary prefix (0 = not a prefix operator).
+// Adding an operator means adding a row here and a case in the
+// interpreter.
+struct OperatorRow
+{
+    TokenType type;
+    uint8_t left;
+    uint8_t right;
+    uint8_t prefix;
+};
+
+inline constexpr OperatorRow OPERATORS[] = {
+    // token                      left right prefix
+    {TokenType::EQUAL_EQUAL,      1,   2,    0},
+    {TokenType::NOT_EQUAL,        1,   2,    0},
+    {TokenType::LESS,             3,   4,    0},
+    {TokenType::LESS_EQUAL,       3,   4,    0},
+    {TokenType::GREATER,          3,   4,    0},
+    {TokenType::GREATER_EQUAL,    3,   4,    0},
+    {TokenType::PLUS,             5,   6,    0},
+    {TokenType::MINUS,            5,   6,    9},
+    {TokenType::STAR,             7,   8,    0},
+    {TokenType::SLASH,            7,   8,    0},
+};
+
+// OPERATORS indexed by token type, so lookups are a single load
+inline constexpr size_t TOKEN_TYPES = static_cast<size_t>(TokenType::INVALID) + 1;
+
+struct BindingTable
+{
+    OperatorRow rows[TOKEN_TYPES] = {};
+};
+
+constexpr BindingTable MakeBindingTable()
+{
+    BindingTable table;
+    for (const OperatorRow& row : OPERATORS)
+        table.rows[static_cast<size_t>(row.type)] = row;
+    return table;
+}
+
+inline constexpr BindingTable BINDING = MakeBindingTable();
+
+constexpr const OperatorRow& Binding(TokenType type)
+{
+    return BINDING.rows[static_cast<size_t>(type)];
+}
 
 class Parser
 {
 private:
-    const std::vector<Token>& tokens;
+    const TokenStream& tokens;
     size_t current;
+    size_t numberIndex; // NUMBER tokens consumed so far, indexes tokens.numbers
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor; // charged for every AST node
+
+    bool usesFunctions = false; // any fn, return or call: the Resolver has work to do
 
 public:
-    Parser(const std::vector<Token>& t)
-        : tokens(t), current(0)
+    constexpr Parser(const TokenStream& t)
+        : tokens(t), current(0), numberIndex(0), governor(ownGovernor)
+    {
+    }
+
+    constexpr Parser(const TokenStream& t, ResourceGovernor& g)
+        : tokens(t), current(0), numberIndex(0), governor(g)
     {
     }
 
     // ================= PROGRAM =================
 
-    std::vector<std::unique_ptr<Stmt>> ParseProgram()
+    // Blocks are parsed with an explicit stack of open statement lists
+    // instead of recursion, so nesting depth is bounded by heap, not by
+    // the native stack. A function body is one more open list.
+    constexpr std::vector<std::unique_ptr<Stmt>> ParseProgram()
     {
-        std::vector<std::unique_ptr<Stmt>> statements;
+        // open[0] is the program itself; open[i > 0] are unclosed blocks
+        std::vector<std::vector<std::unique_ptr<Stmt>>> open(1);
+
+        // Per entry of 'open': the function it is the body of, if any
+        std::vector<std::unique_ptr<FunctionStmt>> functions(1);
 
         while (true)
         {
@@ -35,23 +109,73 @@ public:
 
             // Stop cleanly at EOF
             if (IsAtEnd())
+            {
+                if (open.size() > 1)
+                    throw std::runtime_error("Unterminated block");
                 break;
+            }
+
+            governor.PollDeadline();
 
-            // Top-level '}' is illegal
+            // End of block
             if (Check(TokenType::RBRACE))
-                throw std::runtime_error("Unexpected '}'");
+            {
+                // Top-level '}' is illegal
+                if (open.size() == 1)
+                    throw std::runtime_error("Unexpected '}'");
+
+                Advance();
+                std::unique_ptr<Stmt> closed;
+                if (functions.back())
+                {
+                    functions.back()->body = std::move(open.back());
+                    closed = std::move(functions.back());
+                }
+                else
+                {
+                    closed = Make<BlockStmt>(std::move(open.back()));
+                }
+                open.pop_back();
+                functions.pop_back();
+                open.back().push_back(std::move(closed));
+                Consume(TokenType::NEWLINE, "Expected newline after statement");
+                continue;
+            }
+
+            // Start of block
+            if (Match(TokenType::LBRACE))
+            {
+                // Require newline after '{'
+                Consume(TokenType::NEWLINE, "Expected newline after '{'");
+                open.emplace_back();
+                functions.emplace_back();
+                continue;
+            }
 
-            statements.push_back(ParseStatement());
+            // Start of function: its body is parsed like a block
+            if (Match(TokenType::FN))
+            {
+                functions.push_back(ParseFunctionHeader());
+                Consume(TokenType::LBRACE, "Expected '{' before function body");
+                Consume(TokenType::NEWLINE, "Expected newline after '{'");
+                open.emplace_back();
+                continue;
+            }
+
+            open.back().push_back(ParseStatement());
             Consume(TokenType::NEWLINE, "Expected newline after statement");
         }
 
-        return statements;
+        std::vector<std::unique_ptr<Stmt>> program = std::move(open.front());
+        if (usesFunctions)
+            Resolver(governor).Resolve(program);
+        return program;
     }
 
 private:
     // ================= STATEMENTS =================
 
-    std::unique_ptr<Stmt> ParseStatement()
+    constexpr std::unique_ptr<Stmt> ParseStatement()
     {
         if (Match(TokenType::PRINT))
             return ParsePrint();
@@ -59,8 +183,20 @@ private:
         if(Match(TokenType::VAR))
           return ParseVarDecl();
 
-        if (Match(TokenType::LBRACE))
-            return ParseBlock();
+        if (Match(TokenType::RETURN))
+        {
+            usesFunctions = true;
+            return Make<ReturnStmt>(ParseExpression());
+        }
+
+        // A call on its own, for what it prints
+        if (Check(TokenType::IDENTIFIER) && CheckNext(TokenType::LPAREN))
+        {
+            auto call = ParseExpression();
+            if (!NodeCast<CallExpr>(call.get()))
+                throw std::runtime_error("Expected statement");
+            return Make<ExprStmt>(std::move(call));
+        }
 
         if (Check(TokenType::IDENTIFIER))
             return ParseAssignment();
@@ -68,107 +204,252 @@ private:
         throw std::runtime_error("Expected statement");
     }
 
-    std::unique_ptr<Stmt> ParsePrint()
+    // fn name(a, b), up to the '{'
+    constexpr std::unique_ptr<FunctionStmt> ParseFunctionHeader()
     {
-        auto expr = ParseExpression();
-        return std::make_unique<PrintStmt>(std::move(expr));
+        size_t name = Consume(TokenType::IDENTIFIER, "Expected function name after 'fn'");
+        Consume(TokenType::LPAREN, "Expected '(' after function name");
+
+        std::vector<std::string> params;
+        if (!Check(TokenType::RPAREN))
+        {
+            do
+            {
+                size_t param = Consume(TokenType::IDENTIFIER, "Expected parameter name");
+                params.emplace_back(Lexeme(param));
+            } while (Match(TokenType::COMMA));
+        }
+        Consume(TokenType::RPAREN, "Expected ')' after parameters");
+
+        usesFunctions = true;
+        return Make<FunctionStmt>(std::string(Lexeme(name)), std::move(params),
+                                  std::vector<std::unique_ptr<Stmt>>{});
     }
 
-    std::unique_ptr<Stmt> ParseAssignment()
+    constexpr std::unique_ptr<Stmt> ParsePrint()
     {
-        Token name = Consume(TokenType::IDENTIFIER, "Expected variable name");
-        Consume(TokenType::ASSIGN, "Expected '='");
-
         auto expr = ParseExpression();
-        return std::make_unique<AssignStmt>(name.lexeme, std::move(expr));
+        return Make<PrintStmt>(std::move(expr));
     }
 
-    std::unique_ptr<Stmt> ParseBlock()
+    constexpr std::unique_ptr<Stmt> ParseAssignment()
     {
-        // Require newline after '{'
-        Consume(TokenType::NEWLINE, "Expected newline after '{'");
-
-        std::vector<std::unique_ptr<Stmt>> statements;
+        size_t name = Consume(TokenType::IDENTIFIER, "Expected variable name");
 
-        while (true)
+        // name[index] = value
+        if (Match(TokenType::LBRACKET))
         {
-            // Skip blank lines inside block
-            while (Match(TokenType::NEWLINE))
-            {
-            }
-
-            // End of block
-            if (Check(TokenType::RBRACE))
-                break;
-
-            if (IsAtEnd())
-                throw std::runtime_error("Unterminated block");
-
-            statements.push_back(ParseStatement());
-            Consume(TokenType::NEWLINE, "Expected newline after statement");
+            auto array = Make<VariableExpr>(std::string(Lexeme(name)));
+            auto index = ParseExpression();
+            Consume(TokenType::RBRACKET, "Expected ']'");
+            Consume(TokenType::ASSIGN, "Expected '='");
+            return Make<IndexAssignStmt>(std::move(array), std::move(index), ParseExpression());
         }
 
-        Consume(TokenType::RBRACE, "Expected '}'");
+        Consume(TokenType::ASSIGN, "Expected '='");
 
-        return std::make_unique<BlockStmt>(std::move(statements));
+        auto expr = ParseExpression();
+        return Make<AssignStmt>(std::string(Lexeme(name)), std::move(expr));
     }
 
     // ================= EXPRESSIONS =================
 
-    std::unique_ptr<Expr> ParseExpression()
+    // ---------- Pratt parser ----------
+    //
+    // Pratt parsing driven by the table above, run on explicit operand and
+    // operator stacks instead of recursion (see ParseProgram). An operator
+    // on the stack is reduced once an incoming infix operator binds less
+    // tightly than the stacked operator binds its right operand.
+    //
+    // Calls, array literals and indexing are groups too: their elements
+    // are parsed one after another on the same stacks, and the closing
+    // ')' or ']' collects them into a CallExpr, ArrayExpr or IndexExpr.
+    struct PendingOp
     {
-        return ParseTerm();
-    }
-
-    std::unique_ptr<Expr> ParseTerm()
+        enum Group : uint8_t
+        {
+            OPERATOR, // not a group
+            PAREN,
+            CALL,
+            ARRAY,
+            INDEX,
+        };
+
+        TokenType type;  // OPERATOR: the operator
+        uint8_t right;   // binding power towards the right operand
+        bool prefix;
+        Group group;
+        size_t name;     // CALL, INDEX: the name token
+        size_t args;     // CALL, ARRAY: index in 'operands' of the first element
+    };
+
+    constexpr std::unique_ptr<Expr> ParseExpression()
     {
-        auto expr = ParseFactor();
+        std::vector<std::unique_ptr<Expr>> operands;
+        std::vector<PendingOp> operators;
+        size_t openGroups = 0;
 
-        while (Match(TokenType::PLUS) || Match(TokenType::MINUS))
+        while (true)
         {
-            char op = Previous().lexeme[0];
-            auto right = ParseFactor();
-            expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
-        }
+            // Prefix position: groups and prefix operators, then an operand
+            bool empty = false; // f() or []
+            while (true)
+            {
+                if (Match(TokenType::LPAREN))
+                {
+                    operators.push_back({TokenType::LPAREN, 0, false, PendingOp::PAREN, 0, 0});
+                    ++openGroups;
+                    continue;
+                }
+
+                if (Match(TokenType::LBRACKET))
+                {
+                    operators.push_back({TokenType::LBRACKET, 0, false, PendingOp::ARRAY, 0,
+                                         operands.size()});
+                    ++openGroups;
+
+                    empty = Check(TokenType::RBRACKET);
+                    if (empty)
+                        break; // the ']' is handled below
+                    continue;
+                }
+
+                if (Check(TokenType::IDENTIFIER) &&
+                    (CheckNext(TokenType::LPAREN) || CheckNext(TokenType::LBRACKET)))
+                {
+                    size_t name = Advance();
+                    TokenType open = tokens.types[Advance()];
+                    auto group = open == TokenType::LPAREN ? PendingOp::CALL : PendingOp::INDEX;
+                    operators.push_back({open, 0, false, group, name, operands.size()});
+                    ++openGroups;
+
+                    empty = group == PendingOp::CALL && Check(TokenType::RPAREN);
+                    if (empty)
+                        break; // the ')' is handled below
+                    continue;
+                }
+
+                const OperatorRow& row = Binding(Peek());
+                if (row.prefix == 0)
+                    break;
+
+                Advance();
+                operators.push_back({row.type, row.prefix, true, PendingOp::OPERATOR, 0, 0});
+            }
+
+            if (!empty)
+                operands.push_back(ParsePrimary());
 
-        return expr;
+            // Infix position: an operator, a closing ')' or ']', a ',' or the end
+            while (true)
+            {
+                const OperatorRow& row = Binding(Peek());
+                if (row.left > 0)
+                {
+                    Advance();
+
+                    while (!operators.empty() && operators.back().right >= row.left)
+                        Reduce(operands, operators);
+
+                    operators.push_back({row.type, row.right, false, PendingOp::OPERATOR, 0, 0});
+                    break;
+                }
+
+                if (openGroups == 0)
+                {
+                    while (!operators.empty())
+                        Reduce(operands, operators);
+                    return std::move(operands.back());
+                }
+
+                while (operators.back().group == PendingOp::OPERATOR)
+                    Reduce(operands, operators);
+
+                PendingOp group = operators.back();
+                bool list = group.group == PendingOp::CALL || group.group == PendingOp::ARRAY;
+                if (list && Match(TokenType::COMMA))
+                    break; // next element
+
+                if (group.group == PendingOp::ARRAY || group.group == PendingOp::INDEX)
+                    Consume(TokenType::RBRACKET, "Expected ']'");
+                else
+                    Consume(TokenType::RPAREN, "Expected ')'");
+
+                operators.pop_back();
+                --openGroups;
+
+                if (group.group == PendingOp::INDEX)
+                {
+                    auto array = Make<VariableExpr>(std::string(Lexeme(group.name)));
+                    operands.back() = Make<IndexExpr>(std::move(array), std::move(operands.back()));
+                    continue;
+                }
+
+                if (!list)
+                    continue;
+
+                std::vector<std::unique_ptr<Expr>> args;
+                for (size_t i = group.args; i < operands.size(); ++i)
+                    args.push_back(std::move(operands[i]));
+                operands.resize(group.args);
+
+                if (group.group == PendingOp::ARRAY)
+                {
+                    operands.push_back(Make<ArrayExpr>(std::move(args)));
+                    continue;
+                }
+
+                usesFunctions = true;
+                operands.push_back(Make<CallExpr>(std::string(Lexeme(group.name)),
+                                                  std::move(args)));
+            }
+        }
     }
 
-    std::unique_ptr<Expr> ParseFactor()
+    constexpr void Reduce(std::vector<std::unique_ptr<Expr>>& operands,
+                std::vector<PendingOp>& operators)
     {
-        auto expr = ParsePrimary();
+        PendingOp op = operators.back();
+        operators.pop_back();
+
+        auto right = std::move(operands.back());
 
-        while (Match(TokenType::STAR) || Match(TokenType::SLASH))
+        if (op.prefix)
         {
-            char op = Previous().lexeme[0];
-            auto right = ParsePrimary();
-            expr = std::make_unique<BinaryExpr>(op, std::move(expr), std::move(right));
+            operands.back() = Make<UnaryExpr>(op.type, std::move(right));
+            return;
         }
 
-        return expr;
+        operands.pop_back();
+        auto left = std::move(operands.back());
+        operands.back() = Make<BinaryExpr>(op.type, std::move(left), std::move(right));
     }
 
-    std::unique_ptr<Expr> ParsePrimary()
+    constexpr std::unique_ptr<Expr> ParsePrimary()
     {
         if (Match(TokenType::NUMBER))
-            return std::make_unique<NumberExpr>(std::stod(Previous().lexeme));
+            return Make<NumberExpr>(tokens.numbers[numberIndex - 1]);
 
-        if (Match(TokenType::IDENTIFIER))
-            return std::make_unique<VariableExpr>(Previous().lexeme);
+        if (Match(TokenType::STRING))
+            return Make<StringExpr>(std::string(Lexeme(Previous())));
 
-        if (Match(TokenType::LPAREN))
-        {
-            auto expr = ParseExpression();
-            Consume(TokenType::RPAREN, "Expected ')'");
-            return expr;
-        }
+        if (Match(TokenType::IDENTIFIER))
+            return Make<VariableExpr>(std::string(Lexeme(Previous())));
 
         throw std::runtime_error("Expected expression");
     }
 
     // ================= HELPERS =================
 
-    bool Match(TokenType type)
+    // Allocates an AST node and charges it to the memory budget.
+    template <typename T, typename... Args>
+    constexpr std::unique_ptr<T> Make(Args&&... args)
+    {
+        governor.Charge(sizeof(T));
+        return std::make_unique<T>(std::forward<Args>(args)...);
+    }
+
+    constexpr bool Match(TokenType type)
     {
         if (Check(type))
         {
@@ -178,49 +459,66 @@ private:
         return false;
     }
 
-    Token Consume(TokenType type, const char* msg)
+    // Returns the index of the consumed token
+    constexpr size_t Consume(TokenType type, const char* msg)
     {
         if (Check(type))
             return Advance();
         throw std::runtime_error(msg);
     }
 
-    bool Check(TokenType type) const
+    constexpr bool Check(TokenType type) const
     {
         if (IsAtEnd())
             return false;
-        return Peek().type == type;
+        return Peek() == type;
+    }
+
+    // The token after the current one
+    constexpr bool CheckNext(TokenType type) const
+    {
+        return !IsAtEnd() && tokens.types[current + 1] == type;
     }
 
-    Token Advance()
+    // Returns the index of the consumed token
+    constexpr size_t Advance()
     {
         if (!IsAtEnd())
+        {
+            if (Peek() == TokenType::NUMBER)
+                numberIndex++;
             current++;
+        }
         return Previous();
     }
 
-    bool IsAtEnd() const
+    constexpr bool IsAtEnd() const
+    {
+        return Peek() == TokenType::END_OF_FILE;
+    }
+
+    constexpr TokenType Peek() const
     {
-        return Peek().type == TokenType::END_OF_FILE;
+        return tokens.types[current];
     }
 
-    Token Peek() const
+    constexpr size_t Previous() const
     {
-        return tokens[current];
+        return current - 1;
     }
 
-    Token Previous() const
+    constexpr std::string_view Lexeme(size_t token) const
     {
-        return tokens[current - 1];
+        return tokens.Lexeme(token);
     }
 
-    std::unique_ptr<Stmt> ParseVarDecl()
+    constexpr std::unique_ptr<Stmt> ParseVarDecl()
     {
-        Token name = Consume(TokenType::IDENTIFIER, "Expected variable name after 'var'");
+        size_t name = Consume(TokenType::IDENTIFIER, "Expected variable name after 'var'");
         Consume(TokenType::ASSIGN, "Expected '=' after variable name");
     
         auto init = ParseExpression();
-        return std::make_unique<VarDeclStmt>(name.lexeme, std::move(init));
+        return Make<VarDeclStmt>(std::string(Lexeme(name)), std::move(init));
     }
 
 
@@ -10,7 +10,9 @@ This project implements a minimal programming language with:
 
 -   Assignment statements\
 -   Print statements\
--   Numeric expressions (`+ - * /`)\
+-   Numeric expressions (`+ - * /`, unary `-`)\
+-   Comparisons (`== != < <= > >=`, yielding 1 or 0)\
+-   String literals; `+` concatenates when either side is a string\
 -   Variables\
 -   Parentheses\
 -   Newline as statement delimiter
@@ -96,10 +98,15 @@ The interpreter is a **stateful executor**.
 ``` cpp
 class Interpreter
 {
-    std::unordered_map<std::string, double> variables;
+    std::vector<std::unordered_map<std::string, Value>> scopes;
 };
 ```
 
+`Value` (`value.h`) is a NaN-boxed 64-bit word: a number is stored as
+its raw `double`, anything else (today: an interned string) as a tagged
+pointer inside a quiet NaN. Numeric operations only pay for two tag
+tests.
+
 #### Why store state in the class?
 
 -   Variables must persist across statements
@@ -150,15 +157,27 @@ void ExecuteStmt(const Stmt* stmt);
 Expressions **produce values**.
 
 ``` cpp
-double EvaluateExpr(const Expr* expr);
+void Evaluate(size_t workBase);
 ```
 
+`ExecuteStmt` pushes a statement's expression onto an explicit work stack
+instead of calling a recursive evaluator. `Evaluate` pops work items
+until the stack is back at `workBase`. Visiting a node pushes its
+operands, followed by an item that applies the operator once their values
+are on the value stack. A binary expression, for instance, becomes
+`APPLY_BINARY`, then the right operand, then the left. The statement's
+completion (assign, declare, print) is the last item and takes the
+finished value.
+
 ### Why expressions return a value
 
 This matches mathematical semantics:
 
     expression → value
 
+The explicit stacks keep that model without native recursion: a chain of
+300,000 nested parentheses costs heap memory, not C++ stack frames.
+
 ------------------------------------------------------------------------
 
 ## 9. Performance Characteristics
@@ -167,13 +186,14 @@ This matches mathematical semantics:
 
 ✔ Extremely simple\
 ✔ Minimal code\
-✔ Easy to debug
+✔ Easy to debug\
+✔ No native recursion: parsing, evaluation and AST teardown use explicit
+heap stacks, so nesting depth is limited only by memory
 
 ### Disadvantages
 
 ✘ Slow for large programs\
-✘ Hard to optimize\
-✘ Deep recursion risk
+✘ Hard to optimize
 
 ------------------------------------------------------------------------
 
@@ -183,3 +203,249 @@ This matches mathematical semantics:
 
 ------------------------------------------------------------------------
 
+## 11. Resource Limits
+
+Untrusted scripts run under a `ResourceGovernor` (`governor.h`):
+
+  Flag             Limit                              Exit code
+  ---------------- ---------------------------------- ---------
+  `--max-steps`    statements + expressions executed  2
+  `--max-memory`   bytes of AST nodes and scopes      3
+  `--timeout`      wall clock in milliseconds         4
+
+The closure tier and the IR charge the memory budget for their own
+structures, slots and instructions, instead of scope entries. The IR
+also drops strings that nothing uses. So a budget within a few hundred
+bytes of a script's needs may run out at a different statement in
+each tier.
+
+`Step()` is a single decrement; total steps and the clock are only
+checked once per 4096 steps, so the governor stays enabled on the hot
+path. The lexer and parsers poll the deadline the same way, reading the
+clock once per 4096 lines or statements. `make bench` measures the
+overhead in place. It times the same tree-walk run, with every limit set,
+against a `-DUNGOVERNED` build in which the accounting compiles to
+nothing. The difference is within run-to-run noise. Limit flags take
+whole numbers above zero, and `make test` checks each exit code and
+message.
+
+------------------------------------------------------------------------
+## 12. Closure Compilation (`--closures`)
+
+`ClosureCompiler` (`closure.h`) is a middle tier between the tree walk
+and a bytecode VM. Before running, every statement and expression is
+converted into a `std::function` specialized for its shape: variables
+become slot indices, operators become template arguments, and common
+shapes such as `x = y + 1` or `x = y * z` become a single fused closure.
+Blocks disappear entirely because scopes are resolved at compile time.
+
+Each statement charges its steps once, just before its effect. A node
+that is about to fail or allocate a string first charges the steps the
+tree walker would have taken up to it, so `--max-steps` stops a script
+at the same point with the same error. `make test` checks this: it runs
+every script in `tests/` under each step budget up to 80, and under
+memory budgets whose outcome does not depend on the tier. Each run must
+match the tree walker's stdout, stderr and exit code.
+
+Programs the compiler cannot handle (today: expressions nested deeper
+than 2000 levels) throw `UnsupportedProgram` before anything has run, and
+`main` falls back to the tree walker.
+
+While compiling, `typeinfer.h` tracks the integer range of every slot and
+expression. Anything proven to be an exact integer within 2^53 that can
+never be `-0` runs on `int64_t` instead of boxed doubles; division and
+strings always stay on the `Value` path. Printed output is identical.
+
+Compiling is not free. Names are resolved through one flat table
+(`scopes.h`) instead of a hash map per block, and operands are moved,
+never copied, into their parent closure. Even so, each statement still
+costs a few `std::function` allocations. The language has no loops, so
+every compiled statement runs exactly once and the compile cost is never
+paid back. `make bench` reports compile plus run against the tree walk;
+on its 200,000-line scripts running the closures is over 20x faster, but
+end to end this tier is about as fast as the tree walker or slower
+(0.7-0.9x). Use it for its step-exact semantics, not for speed.
+
+------------------------------------------------------------------------
+## 13. SSA IR (`--ir`, `--dump-ir`)
+
+`IrCompiler` (`ir.h`) lowers the AST into a straight-line SSA form.
+Block scopes are flattened: every `var` and assignment binds a new
+version of the name (`x.1`, `x.2`, ...), and reads refer to that value
+directly. Name and type errors are found while lowering and become a
+`trap` instruction, so every other instruction is pure.
+
+`Optimize()` then runs three passes:
+
+-   copy propagation (`x = y` reads `y` directly)
+-   common-subexpression elimination, across statements and scopes
+-   dead-code elimination, which drops every `var` that is never read
+
+`--dump-ir` prints the optimized instructions instead of running them;
+`--ir` executes them. Output, errors and step accounting match the tree
+walker, and `make test` compares them as it does for closures. The
+scripts in `tests/golden/` also pin down the dump for each pass and for
+traps (`tests/golden.sh`).
+
+Lowering shares `ScopeTable` with the closure tier, and keeps versions as
+(name, number) pairs that are only formatted by `--dump-ir`. As with the
+closures, the language has no loops, so optimizing never pays for
+itself: in `make bench`, lowering plus optimizing still takes a little
+longer than the tree walk of the same script (about 0.8x end to end),
+while running the result takes under a millisecond.
+
+------------------------------------------------------------------------
+## 14. Snapshots (`--snapshot`, `--restore`)
+
+Scripts that share a long prelude of declarations can skip it:
+
+    ./a.out --snapshot prelude.snap prelude.txt
+    ./a.out --restore prelude.snap script.txt
+
+`--snapshot` writes the global scope after a successful run, together
+with the length and hash of the source that produced it. `--restore`
+maps that file and checks that the script begins with the same prelude.
+It then lexes, parses and runs only the rest of the script. The prelude's
+output is not repeated. Both flags can be combined to extend a snapshot,
+and both use the tree walker (`snapshot.h`).
+
+The file holds a hash index of the globals, and the interpreter looks
+names up in the mapping itself. A global is copied into the global scope,
+and its string value interned, only when the script first uses it;
+unused globals cost nothing. Restoring is therefore independent of the
+number of globals (a 200,000-global prelude restores and runs one line
+in about 20 ms), apart from hashing the prelude's source to check it.
+The memory budget is charged for each global when it is copied in.
+`make test` covers round trips and rejects truncated files, bad magic
+numbers and mismatched preludes (`tests/snapshot.sh`).
+
+------------------------------------------------------------------------
+## 15. Generated Table Parser (`--table-parser`)
+
+The `grammar` file is the source of a second parser. `make` builds
+`grammargen` and runs it on `grammar` to produce `grammar_tables.h`:
+
+-   groups and repetitions are rewritten into helper rules
+-   FIRST/FOLLOW sets give each production its predict set; two
+    productions predicting the same token is an LL(1) conflict, which is
+    printed and fails the build
+-   tokens with identical parse-table columns share a token class
+-   every table entry is expanded down to its first token, so a chain
+    like expression → ... → primary is pushed in one step
+
+`TableParser` (`table_parser.h`) is a generic loop over those tables. The
+`@name` markers in `grammar` are its actions, which build the same AST as
+`Parser`. Only syntax error messages differ: they name the rule and list
+the tokens that were expected. `make test` runs the valid scripts in
+`tests/` through both parsers and compares the results. Since the
+messages differ, the `syntax_*` scripts in `tests/golden/` pin down each
+parser's rejection of the same broken source instead. `make bench`
+compares the throughput of both parsers; the hand-written Pratt parser
+is still faster, by roughly 1.3-2x per token.
+
+------------------------------------------------------------------------
+## 16. Compile-Time Evaluation (`compiletime.h`)
+
+A script written as a C++ string literal can run while the program is
+being compiled:
+
+    constexpr auto limits = EvaluateScript<"var max = 8 * 1024\nprint max\n">();
+    static_assert(limits.Find("max")->number == 8192);
+
+The result is a constant table of every printed value and of the final
+global variables, in declaration order; `Print()` writes the prints as
+the interpreter would. An invalid script does not compile.
+
+`Lexer`, `Parser` and the AST are constexpr and shared with the normal
+build. Evaluation uses `ConstantEvaluator`, which follows the tree
+walker's rules and error messages but keeps strings by value, since the
+interpreter's interned NaN-boxed strings cannot exist at compile time.
+Three limits apply only there: number literals must be exact under
+Clinger's fast path (at most 2^53 as an integer, at most 22 decimals),
+a number joined to a string must lie roughly within 1e-15..1e21, and a
+division by zero is not a constant expression. `make test` runs a set
+of scripts both ways and compares their prints and final globals.
+Building needs C++23 (`-std=c++2b`) for constexpr `std::unique_ptr`.
+
+------------------------------------------------------------------------
+## 17. Functions (`resolver.h`)
+
+    fn hypot2(a, b) {
+        return a * a + b * b
+    }
+    print hypot2(3, 4)
+
+Functions are declared at top level and can be called from anywhere in
+the script, before or after their declaration. A call is an expression;
+on its own line it runs for what it prints. A function that ends without
+`return` returns 0.
+
+`Resolver` runs after parsing, with either parser, whenever a script
+declares or calls a function. It links each call to its function and
+checks arity, so an undefined function or a wrong argument count is
+reported before anything runs. Inside a function every parameter and
+`var` becomes a numbered slot of the call frame, and any other name is a
+global. The tree walker keeps all frames on one value stack: a call
+pushes its arguments, runs the body's statements on the same explicit
+work stack as the rest of the program, and pops them when it returns.
+Recursion is limited to 65536 nested calls.
+
+Calls to a small function whose body is only `return expr`, with no
+calls of its own, are inlined: the resolver copies the expression into
+the call site and the tree walker evaluates it over the arguments without
+a frame. Step counts are unchanged. `make bench` compares code written
+out by hand, inlined calls and calls that need a frame.
+
+Inlining removes the frame, not the call: a line such as
+`acc = step(acc)` still visits the call and its argument and runs the
+argument-passing and result work items, on top of the copied
+expression, and every call site holds its own copy. On the 200000-line
+benchmark an inlined call costs about 1.5x the line written out (around
+550 against 380 ns, noisy) and about 0.6x a call with a frame.
+Evaluating one shared body instead of the copies measured no faster.
+
+Only the tree walker runs functions. `--closures` and `--ir` fall back to
+it, while `--dump-ir`, `--snapshot` and compile-time evaluation reject
+scripts that declare functions. The `func_*` scripts in `tests/golden/`
+pin down arity errors, call stack overflow, `return` outside a function
+and inlined calls made from inside framed ones, under every tier flag.
+
+------------------------------------------------------------------------
+## 18. Arrays (`array.h`)
+
+    var x = range(100000)
+    var y = x * 0.5 + 1
+    y[0] = -1
+    print sum(y) / len(y)
+    print [min(y), max(y)]
+
+An array is a fixed-size list of numbers. `[a, b, c]` and the builtins
+`array(n)` (n zeros) and `range(n)` (0 to n-1) create one, `a[i]` reads
+an element and `a[i] = v` stores one. Arrays are shared, not copied:
+after `var b = a`, a store through `b` is seen through `a`, and `==`
+compares identity as for strings.
+
+`+ - * /` with an array and an array of the same length, or an array and
+a number, give a new array; unary `-` works too. `sum`, `min`, `max` and
+`len` reduce an array to a number, and `print` shows `[1, 2, 3]`. The
+builtins' names cannot be declared as functions.
+
+Each array is one 64-byte-aligned allocation (`ArrayHeap`) charged to
+the memory budget; elements are never boxed. Operators run loops written
+once with GCC vector types and compiled twice: for SSE2 and, through
+`target("avx2")` wrappers, for AVX2, which is used when the CPU has it.
+Element-wise results are exact, so they are the same either way. `sum`
+keeps 8 partial sums in a fixed order, so it agrees across CPUs but can
+differ in the last bits from adding one element at a time. `make bench`
+compares both kernel sets and a script written one variable per element.
+`tests/kernels.cpp` (run by `make test`) checks both sets against plain
+loops at lengths around the vector widths, the sums against the same
+8-lane order, and that arrays over `Array::MAX_SIZE` are refused.
+`a.out` is built with `-O2`: without optimization GCC does not inline the
+kernels into the AVX2 wrappers, and they run as plain SSE2 loops.
+
+Arrays need the tree walker. `--closures` and `--ir` fall back to it,
+while `--dump-ir`, compile-time evaluation and `--snapshot` (for an
+array in a global) reject them.
+
+------------------------------------------------------------------------
@@ -0,0 +1,409 @@
+#pragma once
+
+#include "ast.h"
+#include "governor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// ---------- Name resolution ----------
+//
+// Runs on every parsed program that declares or calls a function, from
+// both parsers, before any tier sees it:
+//
+//   - functions are declared at top level and visible everywhere, so each
+//     call is linked to its FunctionStmt, or to a builtin, and its arity
+//     is checked
+//   - inside a function body every parameter and 'var' gets a slot of the
+//     call frame, reused once its block ends; other names are globals
+//   - calls to small leaf functions are inlined (see InlineCalls)
+//
+// Errors found here are reported before anything runs. Like the parsers,
+// it never recurses, and it is constexpr so compile-time parsing works.
+class Resolver
+{
+public:
+    // Functions whose body is 'return expr' with at most this many nodes,
+    // and only arithmetic on literals and names, are copied into their
+    // call sites
+    static constexpr size_t INLINE_NODES = 16;
+
+    // Every builtin takes one argument
+    static constexpr std::pair<std::string_view, Builtin> BUILTINS[] = {
+        {"array", Builtin::ARRAY}, {"len", Builtin::LEN}, {"max", Builtin::MAX},
+        {"min", Builtin::MIN},     {"range", Builtin::RANGE}, {"sum", Builtin::SUM},
+    };
+
+    constexpr explicit Resolver(ResourceGovernor& g)
+        : governor(g)
+    {
+    }
+
+    constexpr void Resolve(std::vector<std::unique_ptr<Stmt>>& program)
+    {
+        DeclareFunctions(program);
+
+        struct Frame
+        {
+            std::vector<std::unique_ptr<Stmt>>* statements;
+            size_t next;
+            bool scope;    // a block inside a function: ends a local scope
+            bool function; // a function body
+        };
+
+        std::vector<Frame> frames;
+        frames.push_back({&program, 0, false, false});
+
+        while (!frames.empty())
+        {
+            Frame& frame = frames.back();
+
+            if (frame.next == frame.statements->size())
+            {
+                if (frame.scope || frame.function)
+                {
+                    locals.resize(scopes.back());
+                    scopes.pop_back();
+                }
+                if (frame.function)
+                    function = nullptr;
+                frames.pop_back();
+                continue;
+            }
+
+            Stmt* stmt = (*frame.statements)[frame.next++].get();
+
+            if (auto fn = NodeCast<FunctionStmt>(stmt))
+            {
+                if (frames.size() > 1)
+                    throw std::runtime_error("Functions must be declared at top level");
+
+                function = fn;
+                scopes.push_back(0);
+                for (const std::string& param : fn->params)
+                    DeclareLocal(param);
+                frames.push_back({&fn->body, 0, false, true});
+                continue;
+            }
+
+            if (auto block = NodeCast<BlockStmt>(stmt))
+            {
+                if (function)
+                    scopes.push_back(locals.size());
+                frames.push_back({&block->statements, 0, function != nullptr, false});
+                continue;
+            }
+
+            ResolveStmt(stmt);
+        }
+
+        InlineCalls();
+    }
+
+private:
+    ResourceGovernor& governor; // charged for inlined copies
+
+    std::vector<std::pair<std::string_view, FunctionStmt*>> functions; // sorted by name
+    std::vector<CallExpr*> calls;
+
+    // The function being resolved, its locals by slot, and locals.size()
+    // where each of its open scopes began
+    FunctionStmt* function = nullptr;
+    std::vector<std::string_view> locals;
+    std::vector<size_t> scopes;
+
+    // ================= DECLARATIONS =================
+
+    constexpr void DeclareFunctions(std::vector<std::unique_ptr<Stmt>>& program)
+    {
+        for (auto& stmt : program)
+            if (auto fn = NodeCast<FunctionStmt>(stmt.get()))
+                functions.push_back({fn->name, fn});
+
+        std::sort(functions.begin(), functions.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (size_t i = 1; i < functions.size(); ++i)
+            if (functions[i - 1].first == functions[i].first)
+                throw std::runtime_error("Function already declared: " + functions[i].second->name);
+
+        for (const auto& [name, fn] : functions)
+            if (FindBuiltin(name) != Builtin::NONE)
+                throw std::runtime_error("Cannot redefine built-in function: " + fn->name);
+    }
+
+    constexpr uint32_t DeclareLocal(std::string_view name)
+    {
+        for (size_t i = scopes.back(); i < locals.size(); ++i)
+            if (locals[i] == name)
+                throw std::runtime_error("Variable already declared in this scope: " +
+                                         std::string(name));
+
+        locals.push_back(name);
+        function->slots = std::max(function->slots, static_cast<uint32_t>(locals.size()));
+        return static_cast<uint32_t>(locals.size() - 1);
+    }
+
+    constexpr NameRef Lookup(std::string_view name) const
+    {
+        if (!function)
+            return {NameRef::SCOPES, 0};
+
+        for (size_t i = locals.size(); i-- > 0;)
+            if (locals[i] == name)
+                return {NameRef::SLOT, static_cast<uint32_t>(i)};
+        return {NameRef::GLOBAL, 0};
+    }
+
+    // ================= STATEMENTS =================
+
+    constexpr void ResolveStmt(Stmt* stmt)
+    {
+        if (auto assign = NodeCast<AssignStmt>(stmt))
+        {
+            ResolveExpr(assign->value.get());
+            assign->ref = Lookup(assign->name);
+            return;
+        }
+
+        // The initializer cannot see the variable it declares
+        if (auto varDecl = NodeCast<VarDeclStmt>(stmt))
+        {
+            ResolveExpr(varDecl->initializer.get());
+            if (function)
+                varDecl->ref = {NameRef::SLOT, DeclareLocal(varDecl->name)};
+            return;
+        }
+
+        if (auto print = NodeCast<PrintStmt>(stmt))
+        {
+            ResolveExpr(print->value.get());
+            return;
+        }
+
+        if (auto store = NodeCast<IndexAssignStmt>(stmt))
+        {
+            ResolveExpr(store->array.get());
+            ResolveExpr(store->index.get());
+            ResolveExpr(store->value.get());
+            return;
+        }
+
+        if (auto call = NodeCast<ExprStmt>(stmt))
+        {
+            ResolveExpr(call->expr.get());
+            return;
+        }
+
+        if (auto ret = NodeCast<ReturnStmt>(stmt))
+        {
+            if (!function)
+                throw std::runtime_error("Return outside function");
+            ResolveExpr(ret->value.get());
+            return;
+        }
+
+        throw std::runtime_error("Unknown statement type");
+    }
+
+    // ================= EXPRESSIONS =================
+
+    constexpr void ResolveExpr(Expr* root)
+    {
+        std::vector<Expr*> pending{root};
+
+        while (!pending.empty())
+        {
+            Expr* expr = pending.back();
+            pending.pop_back();
+
+            if (auto var = NodeCast<VariableExpr>(expr))
+            {
+                var->ref = Lookup(var->name);
+            }
+            else if (auto bin = NodeCast<BinaryExpr>(expr))
+            {
+                pending.push_back(bin->right.get());
+                pending.push_back(bin->left.get());
+            }
+            else if (auto unary = NodeCast<UnaryExpr>(expr))
+            {
+                pending.push_back(unary->operand.get());
+            }
+            else if (auto call = NodeCast<CallExpr>(expr))
+            {
+                size_t params = 1;
+                call->builtin = FindBuiltin(call->callee);
+                if (call->builtin == Builtin::NONE)
+                {
+                    call->function = Find(call->callee);
+                    params = call->function->params.size();
+                    calls.push_back(call);
+                }
+
+                if (call->args.size() != params)
+                    throw std::runtime_error("Wrong number of arguments to " + call->callee +
+                                             ": expected " + Count(params) +
+                                             ", got " + Count(call->args.size()));
+
+                for (size_t i = call->args.size(); i-- > 0;)
+                    pending.push_back(call->args[i].get());
+            }
+            else if (auto array = NodeCast<ArrayExpr>(expr))
+            {
+                for (size_t i = array->elements.size(); i-- > 0;)
+                    pending.push_back(array->elements[i].get());
+            }
+            else if (auto index = NodeCast<IndexExpr>(expr))
+            {
+                pending.push_back(index->index.get());
+                pending.push_back(index->array.get());
+            }
+        }
+    }
+
+    constexpr const FunctionStmt* Find(const std::string& name) const
+    {
+        auto it = std::lower_bound(functions.begin(), functions.end(), std::string_view(name),
+                                   [](const auto& entry, std::string_view key)
+                                   { return entry.first < key; });
+        if (it == functions.end() || it->first != name)
+            throw std::runtime_error("Undefined function: " + name);
+        return it->second;
+    }
+
+    static constexpr Builtin FindBuiltin(std::string_view name)
+    {
+        for (const auto& [builtin, id] : BUILTINS)
+            if (builtin == name)
+                return id;
+        return Builtin::NONE;
+    }
+
+    // std::to_string is not constexpr
+    static constexpr std::string Count(size_t n)
+    {
+        std::string digits;
+        do
+        {
+            digits.insert(digits.begin(), static_cast<char>('0' + n % 10));
+            n /= 10;
+        } while (n > 0);
+        return digits;
+    }
+
+    // ================= INLINING =================
+
+    // A leaf function (its body makes no calls) cannot recurse, and one
+    // that only returns an expression needs no frame: the call site gets
+    // a copy of that expression, whose slots are the evaluated arguments.
+    // Tiers that support calls evaluate it in place of the function body.
+    constexpr void InlineCalls()
+    {
+        for (CallExpr* call : calls)
+        {
+            const Expr* body = InlineBody(*call->function);
+            if (body)
+                call->inlined = Clone(body);
+        }
+    }
+
+    static constexpr const Expr* InlineBody(const FunctionStmt& fn)
+    {
+        if (fn.body.size() != 1)
+            return nullptr;
+
+        auto ret = NodeCast<ReturnStmt>(fn.body.front().get());
+        if (!ret)
+            return nullptr;
+
+        std::vector<const Expr*> pending{ret->value.get()};
+        size_t nodes = 0;
+
+        while (!pending.empty())
+        {
+            const Expr* expr = pending.back();
+            pending.pop_back();
+
+            if (++nodes > INLINE_NODES)
+                return nullptr;
+
+            if (auto bin = NodeCast<BinaryExpr>(expr))
+            {
+                pending.push_back(bin->left.get());
+                pending.push_back(bin->right.get());
+            }
+            else if (auto unary = NodeCast<UnaryExpr>(expr))
+            {
+                pending.push_back(unary->operand.get());
+            }
+            else if (!NodeCast<NumberExpr>(expr) && !NodeCast<StringExpr>(expr) &&
+                     !NodeCast<VariableExpr>(expr))
+            {
+                return nullptr; // calls and arrays
+            }
+        }
+
+        return ret->value.get();
+    }
+
+    // Copies an expression InlineBody accepted, keeping resolved names
+    constexpr std::unique_ptr<Expr> Clone(const Expr* root)
+    {
+        std::unique_ptr<Expr> result;
+        std::vector<std::pair<const Expr*, std::unique_ptr<Expr>*>> pending{{root, &result}};
+
+        while (!pending.empty())
+        {
+            auto [expr, out] = pending.back();
+            pending.pop_back();
+
+            if (auto num = NodeCast<NumberExpr>(expr))
+            {
+                *out = Make<NumberExpr>(num->value);
+            }
+            else if (auto str = NodeCast<StringExpr>(expr))
+            {
+                *out = Make<StringExpr>(str->value);
+            }
+            else if (auto var = NodeCast<VariableExpr>(expr))
+            {
+                auto copy = Make<VariableExpr>(var->name);
+                copy->ref = var->ref;
+                *out = std::move(copy);
+            }
+            else if (auto unary = NodeCast<UnaryExpr>(expr))
+            {
+                auto copy = Make<UnaryExpr>(unary->op, nullptr);
+                pending.push_back({unary->operand.get(), &copy->operand});
+                *out = std::move(copy);
+            }
+            else if (auto bin = NodeCast<BinaryExpr>(expr))
+            {
+                auto copy = Make<BinaryExpr>(bin->op, nullptr, nullptr);
+                pending.push_back({bin->left.get(), &copy->left});
+                pending.push_back({bin->right.get(), &copy->right});
+                *out = std::move(copy);
+            }
+            else
+            {
+                throw std::logic_error("Cannot inline this expression");
+            }
+        }
+
+        return result;
+    }
+
+    template <typename T, typename... Args>
+    constexpr std::unique_ptr<T> Make(Args&&... args)
+    {
+        governor.Charge(sizeof(T));
+        return std::make_unique<T>(std::forward<Args>(args)...);
+    }
+};
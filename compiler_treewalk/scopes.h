@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// ---------- Compile-time scopes ----------
+//
+// Name -> binding map with nested block scopes, for the tiers that
+// resolve every name once before running (closures, IR).
+//
+// A stack of hash maps, one per scope, rehashes and frees on every block
+// and probes each open scope on a lookup. Here all scopes share one
+// open-addressing table of names; each name points at its innermost
+// binding, and bindings made in a scope are undone when it is popped.
+// Keys are views into the AST's strings, which outlive compilation, so
+// nothing is copied.
+//
+// Every distinct name also gets a dense Id(), for per-name side tables.
+template <typename T>
+class ScopeTable
+{
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Starts over with just the outermost scope
+    void Reset()
+    {
+        table.assign(64, NONE);
+        names.clear();
+        bindings.clear();
+        scopeStarts.assign(1, 0);
+    }
+
+    void PushScope()
+    {
+        scopeStarts.push_back(bindings.size());
+    }
+
+    void PopScope()
+    {
+        for (size_t i = bindings.size(); i-- > scopeStarts.back();)
+            names[bindings[i].name].innermost = bindings[i].shadowed;
+
+        bindings.resize(scopeStarts.back());
+        scopeStarts.pop_back();
+    }
+
+    // The innermost binding of name, or nullptr
+    T* Find(std::string_view name)
+    {
+        uint32_t id = Probe(name, Hash(name));
+        if (id == NONE || names[id].innermost == NONE)
+            return nullptr;
+        return &bindings[names[id].innermost].value;
+    }
+
+    bool DeclaredInScope(std::string_view name)
+    {
+        uint32_t id = Probe(name, Hash(name));
+        return id != NONE && names[id].innermost != NONE &&
+               names[id].innermost >= scopeStarts.back();
+    }
+
+    // Binds name in the innermost scope; check DeclaredInScope() first
+    void Declare(std::string_view name, T value)
+    {
+        uint32_t id = Id(name);
+        bindings.push_back({value, id, names[id].innermost});
+        names[id].innermost = static_cast<uint32_t>(bindings.size() - 1);
+    }
+
+    // Dense number of name, from 0, stable until Reset()
+    uint32_t Id(std::string_view name)
+    {
+        size_t hash = Hash(name);
+        uint32_t id = Probe(name, hash);
+        if (id != NONE)
+            return id;
+
+        // Keep the load factor at most 1/2
+        if ((names.size() + 1) * 2 > table.size())
+            Grow();
+
+        id = static_cast<uint32_t>(names.size());
+        names.push_back({name, hash, NONE});
+        table[FreeBucket(hash)] = id;
+        return id;
+    }
+
+    std::string_view Name(uint32_t id) const
+    {
+        return names[id].text;
+    }
+
+private:
+    struct Key
+    {
+        std::string_view text;
+        size_t hash;
+        uint32_t innermost; // index into bindings, or NONE
+    };
+
+    struct Binding
+    {
+        T value;
+        uint32_t name;
+        uint32_t shadowed; // the binding it hides, or NONE
+    };
+
+    std::vector<uint32_t> table; // name ids by hash; size is a power of two
+    std::vector<Key> names;
+    std::vector<Binding> bindings;   // innermost scope last
+    std::vector<size_t> scopeStarts; // bindings.size() when each scope opened
+
+    static size_t Hash(std::string_view name)
+    {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ull;
+        for (char c : name)
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        return static_cast<size_t>(h);
+    }
+
+    uint32_t Probe(std::string_view name, size_t hash) const
+    {
+        size_t mask = table.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            uint32_t id = table[i];
+            if (id == NONE)
+                return NONE;
+            if (names[id].hash == hash && names[id].text == name)
+                return id;
+        }
+    }
+
+    size_t FreeBucket(size_t hash) const
+    {
+        size_t mask = table.size() - 1;
+        size_t i = hash & mask;
+        while (table[i] != NONE)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void Grow()
+    {
+        table.assign(table.size() * 2, NONE);
+        for (size_t id = 0; id < names.size(); ++id)
+            table[FreeBucket(names[id].hash)] = static_cast<uint32_t>(id);
+    }
+};
@@ -0,0 +1,315 @@
+#pragma once
+
+#include "treewalk.h"
+#include "value.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ---------- Snapshot file format ----------
+//
+// A snapshot is the global scope of a finished run plus the source text
+// that produced it (the "prelude"). A later run whose source starts with
+// the same prelude restores the globals and only lexes, parses and runs
+// the rest, as if the prelude had just executed (without its output).
+//
+//   SnapshotHeader
+//   uint32_t table[buckets]   entry index by name hash, or EMPTY
+//   SnapshotEntry[globals]
+//   char text[textSize]       names and string values, each string once
+//
+// The table is an open-addressing hash index (FNV-1a, linear probing), so
+// a restored run looks globals up in the mapped file itself instead of
+// reading every entry up front.
+//
+// All fields are native-endian; snapshots are a cache for one machine,
+// not an exchange format.
+
+struct SnapshotHeader
+{
+    static constexpr char MAGIC[8] = {'T', 'W', 'S', 'N', 'A', 'P', 0, 2};
+    static constexpr uint32_t EMPTY = UINT32_MAX; // free table bucket
+
+    char magic[8];
+    uint64_t preludeSize; // bytes of source covered
+    uint64_t preludeHash; // FNV-1a of those bytes
+    uint32_t globals;
+    uint32_t buckets;     // a power of two, more than 'globals'
+    uint32_t textSize;
+    uint32_t reserved;
+};
+
+struct SnapshotEntry
+{
+    static constexpr uint32_t NUMBER = UINT32_MAX; // 'text' of a number
+
+    uint64_t bits;       // the number's bits
+    uint32_t name;       // offset into text
+    uint32_t nameSize;
+    uint32_t text;       // string value: offset into text, or NUMBER
+    uint32_t textSize;
+};
+
+// FNV-1a, of the prelude and of global names
+inline uint64_t HashSnapshotText(std::string_view text)
+{
+    uint64_t h = 0xcbf29ce484222325;
+    for (unsigned char c : text)
+    {
+        h ^= c;
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+// ---------- Saving ----------
+
+// Snapshots hold numbers and strings only. A run restored from one could
+// not call functions its prelude declared, so such preludes are refused
+// up front; arrays are refused when saving (see SaveSnapshot).
+inline void CheckSnapshotProgram(const std::vector<std::unique_ptr<Stmt>>& program)
+{
+    for (const auto& stmt : program)
+        if (dynamic_cast<const FunctionStmt*>(stmt.get()))
+            throw std::runtime_error("Snapshots cannot hold functions");
+}
+
+// Writes the globals of 'interpreter' after it has executed all of 'source'
+inline void SaveSnapshot(const std::string& path, Interpreter& interpreter,
+                         std::string_view source)
+{
+    // Globals restored from an earlier snapshot but never used
+    interpreter.LoadRestoredGlobals();
+
+    std::vector<SnapshotEntry> entries;
+    std::string text;
+    std::unordered_map<const std::string*, uint32_t> stored; // interned string -> offset
+
+    auto append = [&](std::string_view s)
+    {
+        if (text.size() + s.size() > UINT32_MAX)
+            throw std::runtime_error("Snapshot too large");
+        uint32_t offset = static_cast<uint32_t>(text.size());
+        text.append(s);
+        return offset;
+    };
+
+    for (const auto& [name, value] : interpreter.Globals())
+    {
+        if (value.IsArray())
+            throw std::runtime_error("Snapshots cannot hold arrays: " + name);
+
+        SnapshotEntry e{};
+        e.name = append(name);
+        e.nameSize = static_cast<uint32_t>(name.size());
+        e.text = SnapshotEntry::NUMBER;
+
+        if (value.IsString())
+        {
+            const std::string& s = value.AsString();
+            auto [it, added] = stored.emplace(&s, 0);
+            if (added)
+                it->second = append(s);
+            e.text = it->second;
+            e.textSize = static_cast<uint32_t>(s.size());
+        }
+        else
+        {
+            e.bits = value.Bits();
+        }
+
+        entries.push_back(e);
+    }
+
+    // At most half full, so probes stay short and always find a free bucket
+    uint32_t buckets = 2;
+    while (buckets < 2 * entries.size())
+        buckets *= 2;
+
+    std::vector<uint32_t> table(buckets, SnapshotHeader::EMPTY);
+    for (uint32_t i = 0; i < entries.size(); ++i)
+    {
+        std::string_view name(text.data() + entries[i].name, entries[i].nameSize);
+        size_t b = HashSnapshotText(name) & (buckets - 1);
+        while (table[b] != SnapshotHeader::EMPTY)
+            b = (b + 1) & (buckets - 1);
+        table[b] = i;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+    header.preludeSize = source.size();
+    header.preludeHash = HashSnapshotText(source);
+    header.globals = static_cast<uint32_t>(entries.size());
+    header.buckets = buckets;
+    header.textSize = static_cast<uint32_t>(text.size());
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SnapshotEntry));
+    out.write(text.data(), text.size());
+
+    if (!out)
+        throw std::runtime_error("Cannot write snapshot: " + path);
+}
+
+// ---------- Restoring ----------
+
+// A snapshot file mapped for the rest of the run. Restore() checks the
+// header and the prelude and hands the interpreter this object as the
+// source of its globals; nothing is copied until the script uses a name.
+//
+// Restoring therefore costs the same however many globals the snapshot
+// holds. Each global is only checked, and its string value interned,
+// when first used, so a damaged entry is reported at that point.
+class MappedSnapshot : public GlobalSource
+{
+public:
+    explicit MappedSnapshot(const std::string& p)
+        : path(p)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open snapshot: " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SnapshotHeader)))
+        {
+            close(fd);
+            throw std::runtime_error("Invalid snapshot: " + path);
+        }
+
+        size = static_cast<size_t>(st.st_size);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mapped == MAP_FAILED)
+            throw std::runtime_error("Cannot map snapshot: " + path);
+        bytes = static_cast<const char*>(mapped);
+
+        std::memcpy(&header, bytes, sizeof(header));
+
+        entries = sizeof(header) + size_t(header.buckets) * sizeof(uint32_t);
+        text = entries + size_t(header.globals) * sizeof(SnapshotEntry);
+
+        bool powerOfTwo = header.buckets != 0 && (header.buckets & (header.buckets - 1)) == 0;
+        if (std::memcmp(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic)) != 0 ||
+            !powerOfTwo || header.buckets <= header.globals ||
+            text + header.textSize != size)
+        {
+            munmap(const_cast<char*>(bytes), size);
+            throw std::runtime_error("Invalid snapshot: " + path);
+        }
+    }
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    ~MappedSnapshot() override
+    {
+        munmap(const_cast<char*>(bytes), size);
+    }
+
+    // Checks that 'source' starts with the prelude and lets 'interpreter'
+    // use the saved globals. Returns the offset in 'source' where
+    // execution resumes.
+    size_t Restore(Interpreter& interpreter, std::string_view source)
+    {
+        // The rest must start on a new line, or the prelude's last token
+        // could continue into it
+        size_t resume = header.preludeSize;
+        if (resume > source.size() ||
+            HashSnapshotText(source.substr(0, resume)) != header.preludeHash ||
+            (resume > 0 && resume < source.size() &&
+             source[resume - 1] != '\n' && source[resume] != '\n'))
+            throw std::runtime_error("Source does not start with the snapshot's prelude");
+
+        interpreter.RestoreGlobals(*this);
+        return resume;
+    }
+
+    std::optional<Value> Load(std::string_view name, StringTable& strings) override
+    {
+        uint32_t mask = header.buckets - 1;
+        uint32_t b = static_cast<uint32_t>(HashSnapshotText(name)) & mask;
+
+        // At least one bucket is free, but a damaged table may have none
+        for (uint32_t probes = 0; probes < header.buckets; ++probes, b = (b + 1) & mask)
+        {
+            uint32_t index;
+            std::memcpy(&index, bytes + sizeof(header) + b * sizeof(uint32_t), sizeof(index));
+            if (index == SnapshotHeader::EMPTY)
+                return std::nullopt;
+
+            SnapshotEntry e = Entry(index);
+            if (Slice(e.name, e.nameSize) == name)
+                return Decode(e, strings);
+        }
+
+        throw std::runtime_error("Invalid snapshot: " + path);
+    }
+
+    std::vector<std::string_view> Names() const override
+    {
+        std::vector<std::string_view> names;
+        for (uint32_t i = 0; i < header.globals; ++i)
+        {
+            SnapshotEntry e = Entry(i);
+            names.push_back(Slice(e.name, e.nameSize));
+        }
+        return names;
+    }
+
+private:
+    std::string path;
+    const char* bytes = nullptr;
+    size_t size = 0;
+    SnapshotHeader header;
+    size_t entries = 0; // offset of SnapshotEntry[0]
+    size_t text = 0;    // offset of text[0]
+
+    SnapshotEntry Entry(uint32_t index) const
+    {
+        if (index >= header.globals)
+            throw std::runtime_error("Invalid snapshot: " + path);
+
+        SnapshotEntry e;
+        std::memcpy(&e, bytes + entries + size_t(index) * sizeof(SnapshotEntry), sizeof(e));
+        return e;
+    }
+
+    std::string_view Slice(uint32_t offset, uint32_t length) const
+    {
+        if (uint64_t(offset) + length > header.textSize)
+            throw std::runtime_error("Invalid snapshot: " + path);
+        return std::string_view(bytes + text + offset, length);
+    }
+
+    Value Decode(const SnapshotEntry& e, StringTable& strings) const
+    {
+        if (e.text != SnapshotEntry::NUMBER)
+            return strings.Intern(Slice(e.text, e.textSize));
+
+        double d;
+        std::memcpy(&d, &e.bits, sizeof(d));
+        Value value = Value::Number(d);
+
+        // Bits from a damaged file must not turn into a string pointer
+        if (!value.IsNumber())
+            throw std::runtime_error("Invalid snapshot: " + path);
+        return value;
+    }
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "token.h"
+#include "ast.h"
+#include "governor.h"
+#include "grammar_tables.h"
+#include "resolver.h"
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Table-driven LL(1) parser generated from the 'grammar' file.
+//
+// The parse loop knows nothing about the language: it pops a symbol,
+// matches a terminal, expands a rule through PARSE_TABLE or runs an
+// action. Everything language-specific is either in grammar_tables.h,
+// which make regenerates whenever 'grammar' changes, or in the actions
+// below, which build the same AST as Parser.
+//
+// Like Parser, it never recurses: nesting only grows the symbol stack and
+// the semantic stacks, which live on the heap.
+class TableParser
+{
+private:
+    const TokenStream& tokens;
+    size_t current;
+    size_t numberIndex; // NUMBER tokens consumed so far, indexes tokens.numbers
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor; // charged for every AST node
+
+    std::vector<uint16_t> symbols; // parse stack, top at the back
+
+    // Semantic stacks used by the actions
+    std::vector<std::unique_ptr<Expr>> exprs;
+    std::vector<TokenType> ops;
+    std::vector<size_t> names; // token indices of declared/assigned names
+    std::vector<std::vector<std::unique_ptr<Stmt>>> open; // program, then unclosed blocks
+
+    // Where an argument or parameter list began on the stacks above
+    struct List
+    {
+        size_t names;
+        size_t exprs;
+    };
+    std::vector<List> lists;
+
+    bool usesFunctions = false; // any fn, return or call: the Resolver has work to do
+
+public:
+    TableParser(const TokenStream& t)
+        : tokens(t), current(0), numberIndex(0), governor(ownGovernor)
+    {
+    }
+
+    TableParser(const TokenStream& t, ResourceGovernor& g)
+        : tokens(t), current(0), numberIndex(0), governor(g)
+    {
+    }
+
+    std::vector<std::unique_ptr<Stmt>> ParseProgram()
+    {
+        using namespace grammar;
+
+        open.clear();
+        open.emplace_back();
+        symbols.assign(1, START);
+
+        while (!symbols.empty())
+        {
+            uint16_t symbol = symbols.back();
+            symbols.pop_back();
+
+            uint16_t kind = symbol & 0xff00;
+            uint16_t index = symbol & 0x00ff;
+            TokenType type = tokens.types[current];
+
+            if (kind == NONTERMINAL)
+            {
+                int16_t production = PARSE_TABLE[index][TOKEN_CLASS[static_cast<size_t>(type)]];
+                if (production < 0)
+                    throw std::runtime_error(SyntaxError(index, type));
+
+                // Stored reversed, so its first symbol ends up on top
+                symbols.insert(symbols.end(), SYMBOLS + OFFSETS[production],
+                               SYMBOLS + OFFSETS[production + 1]);
+                continue;
+            }
+
+            if (kind == ACTION)
+            {
+                Apply(static_cast<Action>(index));
+                continue;
+            }
+
+            bool matches = kind == TOKEN_SET
+                               ? (TOKEN_SETS[index] >> static_cast<size_t>(type)) & 1
+                               : index == static_cast<size_t>(type);
+            if (!matches)
+            {
+                if (kind == TOKEN_SET)
+                    throw std::runtime_error(std::string("Unexpected ") +
+                                             TOKEN_NAMES[static_cast<size_t>(type)]);
+                throw std::runtime_error(std::string("Expected ") + TOKEN_NAMES[index]);
+            }
+
+            if (type == TokenType::NEWLINE)
+                governor.PollDeadline();
+            Advance();
+        }
+
+        std::vector<std::unique_ptr<Stmt>> program = std::move(open.front());
+        if (usesFunctions)
+            Resolver(governor).Resolve(program);
+        return program;
+    }
+
+private:
+    // ================= ACTIONS =================
+
+    // Each action reads the token just matched (Previous()) and the
+    // semantic stacks; see the '@' markers in 'grammar'.
+    void Apply(grammar::Action action)
+    {
+        using grammar::Action;
+
+        switch (action)
+        {
+        // ---------- Expressions ----------
+        case Action::NUMBER:
+            exprs.push_back(Make<NumberExpr>(tokens.numbers[numberIndex - 1]));
+            return;
+
+        case Action::STRING:
+            exprs.push_back(Make<StringExpr>(std::string(Lexeme(Previous()))));
+            return;
+
+        case Action::VARIABLE:
+            exprs.push_back(Make<VariableExpr>(PopName()));
+            return;
+
+        case Action::OP:
+            ops.push_back(tokens.types[Previous()]);
+            return;
+
+        case Action::UNARY:
+        {
+            auto operand = PopExpr();
+            exprs.push_back(Make<UnaryExpr>(PopOp(), std::move(operand)));
+            return;
+        }
+
+        case Action::BINARY:
+        {
+            auto right = PopExpr();
+            auto left = PopExpr();
+            exprs.push_back(Make<BinaryExpr>(PopOp(), std::move(left), std::move(right)));
+            return;
+        }
+
+        // ---------- Calls and functions ----------
+        case Action::LIST:
+            lists.push_back({names.size(), exprs.size()});
+            return;
+
+        case Action::CALL:
+        {
+            usesFunctions = true;
+            std::vector<std::unique_ptr<Expr>> args;
+            for (size_t i = lists.back().exprs; i < exprs.size(); ++i)
+                args.push_back(std::move(exprs[i]));
+            exprs.resize(lists.back().exprs);
+            lists.pop_back();
+            exprs.push_back(Make<CallExpr>(PopName(), std::move(args)));
+            return;
+        }
+
+        // ---------- Arrays ----------
+        case Action::ARRAY:
+        {
+            std::vector<std::unique_ptr<Expr>> elements;
+            for (size_t i = lists.back().exprs; i < exprs.size(); ++i)
+                elements.push_back(std::move(exprs[i]));
+            exprs.resize(lists.back().exprs);
+            lists.pop_back();
+            exprs.push_back(Make<ArrayExpr>(std::move(elements)));
+            return;
+        }
+
+        case Action::INDEX:
+        {
+            auto index = PopExpr();
+            exprs.push_back(Make<IndexExpr>(Make<VariableExpr>(PopName()), std::move(index)));
+            return;
+        }
+
+        case Action::STORE:
+        {
+            auto value = PopExpr();
+            auto index = PopExpr();
+            open.back().push_back(Make<IndexAssignStmt>(Make<VariableExpr>(PopName()),
+                                                        std::move(index), std::move(value)));
+            return;
+        }
+
+        case Action::DISCARD:
+            open.back().push_back(Make<ExprStmt>(PopExpr()));
+            return;
+
+        case Action::RETURN:
+            usesFunctions = true;
+            open.back().push_back(Make<ReturnStmt>(PopExpr()));
+            return;
+
+        case Action::FUNCTION:
+        {
+            usesFunctions = true;
+            std::vector<std::string> params;
+            for (size_t i = lists.back().names; i < names.size(); ++i)
+                params.emplace_back(Lexeme(names[i]));
+            names.resize(lists.back().names);
+            lists.pop_back();
+
+            auto function = Make<FunctionStmt>(PopName(), std::move(params), std::move(open.back()));
+            open.pop_back();
+            open.back().push_back(std::move(function));
+            return;
+        }
+
+        // ---------- Statements ----------
+        case Action::NAME:
+            names.push_back(Previous());
+            return;
+
+        case Action::ASSIGN:
+        {
+            auto value = PopExpr();
+            open.back().push_back(Make<AssignStmt>(PopName(), std::move(value)));
+            return;
+        }
+
+        case Action::VAR:
+        {
+            auto init = PopExpr();
+            open.back().push_back(Make<VarDeclStmt>(PopName(), std::move(init)));
+            return;
+        }
+
+        case Action::PRINT:
+            open.back().push_back(Make<PrintStmt>(PopExpr()));
+            return;
+
+        case Action::BLOCK:
+            open.emplace_back();
+            return;
+
+        case Action::END:
+        {
+            auto block = Make<BlockStmt>(std::move(open.back()));
+            open.pop_back();
+            open.back().push_back(std::move(block));
+            return;
+        }
+        }
+
+        throw std::logic_error("grammar action without an implementation");
+    }
+
+    // ================= HELPERS =================
+
+    // "Unexpected X in rule, expected A, B or C", from the rule's table row
+    static std::string SyntaxError(size_t rule, TokenType type)
+    {
+        using namespace grammar;
+
+        std::vector<const char*> expected;
+        for (size_t t = 0; t < std::size(TOKEN_CLASS); ++t)
+            if (PARSE_TABLE[rule][TOKEN_CLASS[t]] >= 0)
+                expected.push_back(TOKEN_NAMES[t]);
+
+        std::string message = std::string("Unexpected ") + TOKEN_NAMES[static_cast<size_t>(type)] +
+                              " in " + RULE_NAMES[rule] + ", expected ";
+        for (size_t i = 0; i < expected.size(); ++i)
+        {
+            if (i > 0)
+                message += i + 1 == expected.size() ? " or " : ", ";
+            message += expected[i];
+        }
+        return message;
+    }
+
+    std::unique_ptr<Expr> PopExpr()
+    {
+        auto expr = std::move(exprs.back());
+        exprs.pop_back();
+        return expr;
+    }
+
+    TokenType PopOp()
+    {
+        TokenType op = ops.back();
+        ops.pop_back();
+        return op;
+    }
+
+    std::string PopName()
+    {
+        std::string name(Lexeme(names.back()));
+        names.pop_back();
+        return name;
+    }
+
+    // Allocates an AST node and charges it to the memory budget.
+    template <typename T, typename... Args>
+    std::unique_ptr<T> Make(Args&&... args)
+    {
+        governor.Charge(sizeof(T));
+        return std::make_unique<T>(std::forward<Args>(args)...);
+    }
+
+    void Advance()
+    {
+        if (tokens.types[current] == TokenType::END_OF_FILE)
+            return;
+        if (tokens.types[current] == TokenType::NUMBER)
+            numberIndex++;
+        current++;
+    }
+
+    size_t Previous() const
+    {
+        return current - 1;
+    }
+
+    std::string_view Lexeme(size_t token) const
+    {
+        return tokens.Lexeme(token);
+    }
+};
@@ -0,0 +1,136 @@
+// Checks that compile-time evaluation agrees with the interpreter.
+//
+//   make test
+//
+// ConstantEvaluator (compiletime.h) has its own copy of the operator rules
+// and number formatting, since Interpreter cannot run during constant
+// evaluation. Each script below is run through EvaluateScript<> by the
+// compiler and through Interpreter at run time; both must print the same
+// lines and leave every global with the same printed value.
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "compiletime.h"
+#include "lexer.h"
+#include "parser.h"
+#include "treewalk.h"
+#include "value.h"
+
+template <ScriptLiteral Script>
+static bool Check(const char* name)
+{
+    constexpr auto result = EvaluateScript<Script>();
+
+    std::ostringstream expected;
+    result.Print(expected);
+    for (const ConstantBinding& b : result.bindings)
+    {
+        expected << result.Name(b) << " = ";
+        if (b.value.isString)
+            expected << result.Text(b.value);
+        else
+            expected << b.value.number;
+        expected << '\n';
+    }
+
+    // The interpreter prints to std::cout
+    std::ostringstream actual;
+    std::streambuf* console = std::cout.rdbuf(actual.rdbuf());
+
+    TokenStream tokens = Lexer(Script.View()).Tokenize();
+    auto program = Parser(tokens).ParseProgram();
+    Interpreter interpreter;
+    interpreter.Execute(program);
+
+    std::cout.rdbuf(console);
+
+    for (const ConstantBinding& b : result.bindings)
+    {
+        auto found = interpreter.Globals().find(std::string(result.Name(b)));
+        actual << result.Name(b) << " = ";
+        if (found == interpreter.Globals().end())
+            actual << "(missing)";
+        else
+            PrintValue(actual, found->second);
+        actual << '\n';
+    }
+
+    if (interpreter.Globals().size() != result.bindings.size())
+        actual << interpreter.Globals().size() << " globals\n";
+
+    if (expected.str() == actual.str())
+        return true;
+
+    std::printf("FAIL: %s\n--- compile time\n%s--- run time\n%s", name,
+                expected.str().c_str(), actual.str().c_str());
+    return false;
+}
+
+int main()
+{
+    int failures = 0;
+
+    failures += !Check<"var a = 7\n"
+                       "var b = 2\n"
+                       "print a + b * 3\n"
+                       "print (a - b) / 4\n"
+                       "print -a * -b\n"
+                       "print 0 * -1\n"
+                       "print 1 < 2 == 1\n"
+                       "print a >= b\n"
+                       "print a != 7\n">("arithmetic");
+
+    // Concatenation formats numbers itself at compile time
+    failures += !Check<"var s = \"n=\"\n"
+                       "print s + 1\n"
+                       "print s + 1 / 3\n"
+                       "print s + 2 / 3\n"
+                       "print s + 0.1 * 3\n"
+                       "print s + -2.5\n"
+                       "print s + 0 * -1\n"
+                       "print s + 100000\n"
+                       "print s + 999999\n"
+                       "print s + 9999995\n"
+                       "print s + 1234567\n"
+                       "print s + 1234565\n"
+                       "print s + 123456789 * 1000\n"
+                       "print s + 0.0001\n"
+                       "print s + 0.00001\n"
+                       "print s + 0.000123456789\n"
+                       "print s + 1 / 1024 / 1024\n"
+                       "print 42 + s\n">("number formatting");
+
+    failures += !Check<"var a = \"apple\"\n"
+                       "var b = \"banana\"\n"
+                       "print a + b\n"
+                       "print a < b\n"
+                       "print a >= b\n"
+                       "print a == \"apple\"\n"
+                       "print a + b == \"applebanana\"\n"
+                       "print a != b\n"
+                       "print a == 1\n"
+                       "print 1 != b\n"
+                       "print \"\" < a\n">("strings");
+
+    failures += !Check<"var x = 1\n"
+                       "var y = \"outer\"\n"
+                       "{\n"
+                       "    var x = 2\n"
+                       "    y = y + x\n"
+                       "    {\n"
+                       "        x = x * 10\n"
+                       "        var z = x\n"
+                       "        print z\n"
+                       "    }\n"
+                       "    print x\n"
+                       "}\n"
+                       "x = x + 0.5\n"
+                       "print x\n"
+                       "print y\n">("scopes");
+
+    std::printf("compile-time evaluation: %d failures\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Runs each script in tests/golden/ and compares the result with its
+# .expected file. Each line of its .flags file is one run with those
+# options (an empty line: none); without a .flags file it runs once,
+# without options. For every run the .expected file holds "$ OPTIONS",
+# stdout, stderr and "exit N". Unlike tiers.sh, which only checks that
+# the tiers agree, these pin down the output itself.
+#
+#   make test
+#   sh tests/golden.sh ./a.out --update   # rewrite every .expected file
+
+interpreter=${1:-./a.out}
+update=$2
+dir=$(dirname "$0")/golden
+
+case $interpreter in
+    /*) ;;
+    *) interpreter=$(pwd)/$interpreter ;;
+esac
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+failures=0
+
+for script in "$dir"/*.txt
+do
+    base=${script%.txt}
+    if [ -f "$base.flags" ]
+    then
+        cp "$base.flags" "$out/flags"
+    else
+        echo >"$out/flags"
+    fi
+
+    : >"$out/actual"
+    while IFS= read -r flags
+    do
+        # Scripts run from their own directory so messages name them the
+        # same way wherever the tree is
+        (
+            cd "$dir" || exit 1
+            "$interpreter" $flags "$(basename "$script")" >"$out/stdout" 2>"$out/stderr"
+            echo "exit $?" >"$out/code"
+        )
+        echo "\$${flags:+ $flags}" >>"$out/actual"
+        cat "$out/stdout" "$out/stderr" "$out/code" >>"$out/actual"
+    done <"$out/flags"
+
+    if [ "$update" = --update ]
+    then
+        cp "$out/actual" "$base.expected"
+    elif ! cmp -s "$out/actual" "$base.expected"
+    then
+        failures=$((failures + 1))
+        echo "FAIL: $script"
+        diff "$base.expected" "$out/actual" | sed 's/^/    /'
+    fi
+done
+
+echo "golden: $failures failures"
+[ $failures -eq 0 ]
@@ -0,0 +1,211 @@
+// Checks the array kernels (array.h) against plain scalar loops.
+//
+//   make test
+//
+// Every kernel set this CPU can run is checked: Baseline always, Avx2
+// when the CPU has it. Lengths around the vector and REDUCE_LANES widths
+// exercise both the vector loops and the scalar tails. Element-wise
+// results must be bit for bit those of one operation per element, and
+// the reductions those of REDUCE_LANES partial results combined in the
+// documented order, so every set agrees on every CPU.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "array.h"
+
+static int failures = 0;
+
+static void Fail(const ArrayKernels& k, const char* what, size_t n)
+{
+    std::printf("FAIL: %s %s, n = %zu\n", k.name, what, n);
+    failures++;
+}
+
+static bool Same(double a, double b)
+{
+    return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Fractions of both signs, so rounding differences would show
+static std::vector<double> Left(size_t n)
+{
+    std::vector<double> v(n);
+    for (size_t i = 0; i < n; ++i)
+        v[i] = static_cast<double>(i * 7 % 13) - 6.0 + static_cast<double>(i) / 3.0;
+    return v;
+}
+
+static std::vector<double> Right(size_t n)
+{
+    std::vector<double> v(n);
+    for (size_t i = 0; i < n; ++i)
+        v[i] = 0.1 + static_cast<double>(i % 5) * 0.7;
+    return v;
+}
+
+static double Apply(TokenType op, double a, double b)
+{
+    switch (op)
+    {
+    case TokenType::PLUS:  return a + b;
+    case TokenType::MINUS: return a - b;
+    case TokenType::STAR:  return a * b;
+    default:               return a / b;
+    }
+}
+
+// Element i goes to lane i % REDUCE_LANES, then lanes are added pairwise
+static double LaneSum(const std::vector<double>& data)
+{
+    double lanes[REDUCE_LANES] = {};
+    for (size_t i = 0; i < data.size(); ++i)
+        lanes[i % REDUCE_LANES] += data[i];
+    for (size_t width = REDUCE_LANES / 2; width > 0; width /= 2)
+        for (size_t k = 0; k < width; ++k)
+            lanes[k] += lanes[k + width];
+    return lanes[0];
+}
+
+static void CheckMap(const ArrayKernels& k, size_t n)
+{
+    const TokenType OPS[] = {TokenType::PLUS, TokenType::MINUS, TokenType::STAR, TokenType::SLASH};
+    const char* NAMES[] = {"+ arrays", "+ right number", "+ left number",
+                           "- arrays", "- right number", "- left number",
+                           "* arrays", "* right number", "* left number",
+                           "/ arrays", "/ right number", "/ left number"};
+
+    std::vector<double> left = Left(n);
+    std::vector<double> right = Right(n);
+    const double number = -2.5;
+
+    for (TokenType op : OPS)
+    {
+        for (size_t shape = 0; shape < 3; ++shape)
+        {
+            // One extra element, which no kernel may write
+            std::vector<double> out(n + 1, 42.0);
+            const double* a = shape == static_cast<size_t>(ArrayShape::LEFT_NUMBER) ? &number : left.data();
+            const double* b = shape == static_cast<size_t>(ArrayShape::RIGHT_NUMBER) ? &number : right.data();
+            k.map[ArrayKernels::Row(op)][shape](a, b, out.data(), n);
+
+            bool ok = Same(out[n], 42.0);
+            for (size_t i = 0; i < n; ++i)
+            {
+                double x = shape == static_cast<size_t>(ArrayShape::LEFT_NUMBER) ? number : left[i];
+                double y = shape == static_cast<size_t>(ArrayShape::RIGHT_NUMBER) ? number : right[i];
+                ok &= Same(out[i], Apply(op, x, y));
+            }
+            if (!ok)
+                Fail(k, NAMES[ArrayKernels::Row(op) * 3 + shape], n);
+        }
+    }
+
+    std::vector<double> out(n + 1, 42.0);
+    k.negate(left.data(), out.data(), n);
+    bool ok = Same(out[n], 42.0);
+    for (size_t i = 0; i < n; ++i)
+        ok &= Same(out[i], -left[i]);
+    if (!ok)
+        Fail(k, "negate", n);
+}
+
+static void CheckReduce(const ArrayKernels& k, size_t n)
+{
+    std::vector<double> data = Left(n);
+
+    if (!Same(k.sum(data.data(), n), LaneSum(data)))
+        Fail(k, "sum", n);
+
+    // Whole numbers add exactly in any order: the same as one at a time
+    std::vector<double> whole(n);
+    double total = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        whole[i] = static_cast<double>(i * 7 % 13) - 6.0;
+        total += whole[i];
+    }
+    if (!Same(k.sum(whole.data(), n), total))
+        Fail(k, "sum of whole numbers", n);
+
+    if (n == 0)
+        return; // min and max need an element
+
+    double lowest = data[0];
+    double highest = data[0];
+    for (double x : data)
+    {
+        lowest = std::fmin(lowest, x);
+        highest = std::fmax(highest, x);
+    }
+    if (!Same(k.min(data.data(), n), lowest))
+        Fail(k, "min", n);
+    if (!Same(k.max(data.data(), n), highest))
+        Fail(k, "max", n);
+
+    // A NaN anywhere, in the vector loop or the tail, makes both NaN
+    for (size_t at : {size_t(0), n / 2, n - 1})
+    {
+        std::vector<double> withNan = data;
+        withNan[at] = std::nan("");
+        if (!std::isnan(k.min(withNan.data(), n)) || !std::isnan(k.max(withNan.data(), n)))
+            Fail(k, ("NaN at " + std::to_string(at)).c_str(), n);
+    }
+}
+
+static void CheckMaxSize()
+{
+    ArrayHeap heap;
+
+    if (heap.Allocate(0).Size() != 0)
+    {
+        std::printf("FAIL: empty array\n");
+        failures++;
+    }
+
+    try
+    {
+        heap.Allocate(Array::MAX_SIZE + 1);
+        std::printf("FAIL: array of MAX_SIZE + 1 elements allocated\n");
+        failures++;
+    }
+    catch (const std::runtime_error& e)
+    {
+        if (std::string(e.what()).rfind("Array too large", 0) != 0)
+        {
+            std::printf("FAIL: array of MAX_SIZE + 1 elements: %s\n", e.what());
+            failures++;
+        }
+    }
+}
+
+int main()
+{
+    std::vector<ArrayKernels> sets{ArrayKernels::Baseline()};
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2"))
+        sets.push_back(ArrayKernels::Avx2());
+    else
+        std::printf("avx2: not supported by this CPU, not checked\n");
+#endif
+
+    // Empty, one element, either side of the vector width, and past
+    // several rounds of REDUCE_LANES
+    for (const ArrayKernels& k : sets)
+    {
+        for (size_t n : {0, 1, 7, 8, 9, 33})
+        {
+            CheckMap(k, n);
+            CheckReduce(k, n);
+        }
+    }
+
+    CheckMaxSize();
+
+    std::printf("array kernels: %d failures\n", failures);
+    return failures != 0;
+}
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Checks the resource limits from the command line: each budget stops a
+# script with its own message and exit code, and limit flags reject
+# values that are not whole numbers above zero.
+#
+#   make test
+
+interpreter=${1:-./a.out}
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+failures=0
+
+# expect CODE STDERR ARGS...: the first line of stderr and the exit code
+expect()
+{
+    code=$1
+    message=$2
+    shift 2
+    "$interpreter" "$@" >"$out/stdout" 2>"$out/stderr"
+    actual=$?
+    first=$(head -n 1 "$out/stderr")
+    if [ $actual -ne $code ] || [ "$first" != "$message" ]
+    then
+        failures=$((failures + 1))
+        echo "FAIL: $*"
+        echo "    expected exit $code: $message"
+        echo "    got exit $actual: $first"
+    fi
+}
+
+printf 'var a = 1\nprint a\nprint a + 1\n' >"$out/small.txt"
+
+# Long enough that lexing it takes far more than a millisecond
+awk 'BEGIN { for (i = 0; i < 300000; i++) print "var v" i " = " i " * 2" }' >"$out/large.txt"
+
+# The script takes exactly 8 steps
+expect 0 "" --max-steps 8 --max-memory 1000000 --timeout 60000 "$out/small.txt"
+expect 2 "Error: Step budget exhausted (7 steps)" --max-steps 7 "$out/small.txt"
+expect 3 "Error: Memory budget exceeded (64 bytes)" --max-memory 64 "$out/small.txt"
+expect 4 "Error: Deadline exceeded (1 ms)" --timeout 1 "$out/large.txt"
+expect 4 "Error: Deadline exceeded (1 ms)" --timeout 1 --table-parser "$out/large.txt"
+
+# The budget that runs out first decides the error
+expect 2 "Error: Step budget exhausted (1 steps)" --max-steps 1 --max-memory 1000000 "$out/small.txt"
+
+usage="Usage: $interpreter [options] <source-file>"
+for value in 0 -1 -5 3x ""
+do
+    expect 1 "$usage" --max-steps "$value" "$out/small.txt"
+    expect 1 "$usage" --max-memory "$value" "$out/small.txt"
+    expect 1 "$usage" --timeout "$value" "$out/small.txt"
+done
+
+echo "limits: $failures failures"
+[ $failures -eq 0 ]
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Runs scripts nested 300,000 levels deep through both parsers and every
+# tier. Parsing, evaluation and AST teardown use explicit heap stacks, so
+# each must finish with the right output instead of overflowing the C++
+# stack. The closure tier falls back to the tree walker for these.
+#
+#   make test
+
+interpreter=${1:-./a.out}
+depth=300000
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+failures=0
+
+awk -v n=$depth 'BEGIN {
+    printf "print "
+    for (i = 0; i < n; i++) printf "("
+    printf "1"
+    for (i = 0; i < n; i++) printf ")"
+    print ""
+}' >"$out/parentheses.txt"
+
+# An even number of minus signs
+awk -v n=$depth 'BEGIN {
+    printf "print "
+    for (i = 0; i < n; i++) printf "-"
+    print "2"
+}' >"$out/unary.txt"
+
+awk -v n=$depth 'BEGIN {
+    print "var x = 3"
+    for (i = 0; i < n; i++) print "{"
+    print "x = x + 1"
+    for (i = 0; i < n; i++) print "}"
+    print "print x"
+}' >"$out/blocks.txt"
+
+# A left-leaning operator chain, as deep as the others
+awk -v n=$depth 'BEGIN {
+    printf "print 0"
+    for (i = 0; i < n; i++) printf " + 1"
+    print ""
+}' >"$out/chain.txt"
+
+# check SCRIPT EXPECTED
+check()
+{
+    for tier in "" --table-parser --closures --ir
+    do
+        actual=$("$interpreter" $tier "$out/$1" 2>&1)
+        code=$?
+        if [ $code -ne 0 ] || [ "$actual" != "$2" ]
+        then
+            failures=$((failures + 1))
+            echo "FAIL: $tier $1: exit $code: $(echo "$actual" | head -c 200)"
+        fi
+    done
+}
+
+check parentheses.txt 1
+check unary.txt 2
+check blocks.txt 4
+check chain.txt $depth
+
+echo "nesting: $failures failures"
+[ $failures -eq 0 ]
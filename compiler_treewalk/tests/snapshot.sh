@@ -0,0 +1,116 @@
+#!/bin/sh
+# Saves snapshots with --snapshot and runs scripts from them with
+# --restore: the rest of the script must see the prelude's globals as if
+# the prelude had just run, and damaged or mismatched snapshots must be
+# refused before anything runs.
+#
+#   make test
+
+interpreter=${1:-./a.out}
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+failures=0
+
+# expect CODE OUTPUT ARGS...: stdout and stderr together, and the exit code
+expect()
+{
+    code=$1
+    expected=$2
+    shift 2
+    actual=$("$interpreter" "$@" 2>&1)
+    status=$?
+    if [ $status -ne $code ] || [ "$actual" != "$expected" ]
+    then
+        failures=$((failures + 1))
+        echo "FAIL: $*"
+        echo "    expected exit $code: $expected"
+        echo "    got exit $status: $actual"
+    fi
+}
+
+cat >"$out/prelude.txt" <<'EOF'
+var a = 2
+var s = "hi"
+var t = s
+var unused = 0.5
+{
+    var local = 1
+}
+print a
+EOF
+
+# script.txt continues prelude.txt
+cp "$out/prelude.txt" "$out/script.txt"
+cat >>"$out/script.txt" <<'EOF'
+print a * 10
+print s + t
+a = a + 1
+print a
+{
+    var a = "shadow"
+    print a
+}
+print a
+var b = 5
+print b
+fn twice() {
+    return a * 2
+}
+print twice()
+EOF
+
+# Snapshots cannot hold functions: extend.txt continues prelude.txt
+# without any, and more.txt continues extend.txt
+cp "$out/prelude.txt" "$out/extend.txt"
+printf 'a = a + 1\nvar b = 5\nprint a\n' >>"$out/extend.txt"
+cp "$out/extend.txt" "$out/more.txt"
+printf 'print a + b\nprint unused\nprint s + t\n' >>"$out/more.txt"
+
+expect 0 "2" --snapshot "$out/prelude.snap" "$out/prelude.txt"
+
+# Round trip: only the rest runs, and it prints what a full run would
+expect 0 "$(printf '20\nhihi\n3\nshadow\n3\n5\n6')" --restore "$out/prelude.snap" "$out/script.txt"
+expect 0 "$(printf '2\n20\nhihi\n3\nshadow\n3\n5\n6')" "$out/script.txt"
+
+# The prelude itself, restored, leaves nothing to run
+expect 0 "" --restore "$out/prelude.snap" "$out/prelude.txt"
+
+# Restored globals are declared in the global scope
+printf 'var a = 1\n' >"$out/redeclare.txt"
+cat "$out/prelude.txt" "$out/redeclare.txt" >"$out/redeclare_full.txt"
+expect 1 "Error: Variable already declared in this scope: a" \
+    --restore "$out/prelude.snap" "$out/redeclare_full.txt"
+
+printf 'print local\n' >"$out/local.txt"
+cat "$out/prelude.txt" "$out/local.txt" >"$out/local_full.txt"
+expect 1 "Error: Undefined variable: local" --restore "$out/prelude.snap" "$out/local_full.txt"
+
+# Extending a snapshot keeps the globals the script never touched
+expect 0 "3" --restore "$out/prelude.snap" --snapshot "$out/extend.snap" "$out/extend.txt"
+expect 0 "$(printf '8\n0.5\nhihi')" --restore "$out/extend.snap" "$out/more.txt"
+
+# Rejected before anything runs
+expect 1 "Error: Source does not start with the snapshot's prelude" \
+    --restore "$out/prelude.snap" "$out/redeclare.txt"
+
+sed 's/var a = 2/var a = 3/' "$out/script.txt" >"$out/changed.txt"
+expect 1 "Error: Source does not start with the snapshot's prelude" \
+    --restore "$out/prelude.snap" "$out/changed.txt"
+
+head -c 20 "$out/prelude.snap" >"$out/short.snap"
+expect 1 "Error: Invalid snapshot: $out/short.snap" --restore "$out/short.snap" "$out/script.txt"
+
+size=$(wc -c <"$out/prelude.snap")
+head -c $((size - 1)) "$out/prelude.snap" >"$out/truncated.snap"
+expect 1 "Error: Invalid snapshot: $out/truncated.snap" --restore "$out/truncated.snap" "$out/script.txt"
+
+{ printf 'XWSNAP'; tail -c +7 "$out/prelude.snap"; } >"$out/magic.snap"
+expect 1 "Error: Invalid snapshot: $out/magic.snap" --restore "$out/magic.snap" "$out/script.txt"
+
+expect 1 "Error: Cannot open snapshot: $out/missing.snap" \
+    --restore "$out/missing.snap" "$out/script.txt"
+
+echo "snapshot: $failures failures"
+[ $failures -eq 0 ]
@@ -0,0 +1,74 @@
+#!/bin/sh
+# Runs every script in tests/ through each execution tier and checks that
+# stdout, stderr and the exit code match the tree walker's. Each script
+# runs without limits, under every step budget up to MAX_STEPS and under
+# a range of memory budgets.
+#
+#   make test
+
+interpreter=${1:-./a.out}
+dir=$(dirname "$0")
+tiers="--closures --ir --table-parser"
+MAX_STEPS=80
+MEMORY="1 64 262144 1048576 8388608"
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+failures=0
+runs=0
+
+# run NAME FLAGS... SCRIPT: stdout, stderr and exit code in $out/NAME.*
+run()
+{
+    name=$1
+    shift
+    "$interpreter" "$@" >"$out/$name.out" 2>"$out/$name.err"
+    echo $? >"$out/$name.code"
+}
+
+same()
+{
+    cmp -s "$out/$1.out" "$out/$2.out" &&
+    cmp -s "$out/$1.err" "$out/$2.err" &&
+    cmp -s "$out/$1.code" "$out/$2.code"
+}
+
+check()
+{
+    script=$1
+    shift
+    run expected "$@" "$script"
+    for tier in $tiers
+    do
+        run actual "$@" $tier "$script"
+        runs=$((runs + 1))
+        if ! same expected actual
+        then
+            failures=$((failures + 1))
+            echo "FAIL: $tier $* $script"
+            diff "$out/expected.err" "$out/actual.err" | sed 's/^/    /'
+            diff "$out/expected.out" "$out/actual.out" | sed 's/^/    /'
+        fi
+    done
+}
+
+for script in "$dir"/*.txt
+do
+    check "$script"
+
+    steps=1
+    while [ $steps -le $MAX_STEPS ]
+    do
+        check "$script" --max-steps $steps
+        steps=$((steps + 1))
+    done
+
+    for bytes in $MEMORY
+    do
+        check "$script" --max-memory $bytes
+    done
+done
+
+echo "$runs runs, $failures failures"
+[ $failures -eq 0 ]
@@ -1,9 +1,11 @@
 #ifndef __TOKEN__H
 #define __TOKEN__H
 
-#include <string>
+#include <cstdint>
+#include <string_view>
+#include <vector>
 
-enum class TokenType
+enum class TokenType : uint8_t
 {
     // Arithmetic (kept for future, parser may ignore)
     PLUS,
@@ -15,6 +17,9 @@ enum class TokenType
     RPAREN,
     LBRACE,
     RBRACE,
+    LBRACKET,
+    RBRACKET,
+    COMMA,
 
     // Assignment & comparison
     ASSIGN,          // =
@@ -35,16 +40,50 @@ enum class TokenType
 
     VAR,
 
+    FN,
+    RETURN,
+
     // Special
     NEWLINE,
     END_OF_FILE,
     INVALID
 };
 
-struct Token
+// Where a token's text lives in the source
+struct TokenSpan
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Struct-of-arrays token stream: one type byte and one 8-byte span per
+// token, pointing back into the source instead of owning a string.
+// NUMBER literals are decoded once by the lexer into 'numbers', in
+// token order, so the parser never converts text.
+//
+// The source text must outlive the stream.
+struct TokenStream
 {
-    TokenType type;
-    std::string lexeme;
+    std::string_view source;
+    std::vector<TokenType> types;
+    std::vector<TokenSpan> spans;
+    std::vector<double> numbers; // one per NUMBER token
+
+    constexpr size_t Size() const
+    {
+        return types.size();
+    }
+
+    constexpr std::string_view Lexeme(size_t i) const
+    {
+        return source.substr(spans[i].offset, spans[i].length);
+    }
+
+    constexpr void Push(TokenType type, size_t offset, size_t length)
+    {
+        types.push_back(type);
+        spans.push_back({static_cast<uint32_t>(offset), static_cast<uint32_t>(length)});
+    }
 };
 
 #endif
@@ -1,42 +1,217 @@
 #pragma once
 
 #include "ast.h"
+#include "governor.h"
+#include "value.h"
+#include <cmath>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 #include <iostream>
 #include <stdexcept>
 #include <vector>
 #include <memory>
 
+// Globals that stay outside the interpreter's global scope until a script
+// first uses them, such as those of a mapped snapshot (snapshot.h)
+class GlobalSource
+{
+public:
+    virtual ~GlobalSource() = default;
+
+    // The value of global 'name', with any string interned into 'strings'
+    virtual std::optional<Value> Load(std::string_view name, StringTable& strings) = 0;
+
+    virtual std::vector<std::string_view> Names() const = 0;
+};
+
 class Interpreter
 {
 private:
     // Symbol table: variable name -> value
-  std::vector<std::unordered_map<std::string, double>> scopes;
+  std::vector<std::unordered_map<std::string, Value>> scopes;
+  std::vector<size_t> scopeBytes; // memory charged per scope, released on exit
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor;
+
+    StringTable strings; // every string value of the run
+    ArrayHeap arrays;    // every array of the run
+
+    // Globals not yet moved into scopes.front(); a name found there is
+    // never looked up here again
+    GlobalSource* restored = nullptr;
+
+    // A statement list being executed and the index of its next statement.
+    // A function call is a frame too: its parameters and locals are the
+    // slots of 'values' from 'base' on (see NameRef), so calling allocates
+    // no scope.
+    struct Frame
+    {
+        enum Kind : uint8_t
+        {
+            PROGRAM,
+            BLOCK,       // top-level block, with its own scope
+            LOCAL_BLOCK, // block in a function body; its names are slots
+            CALL,
+        };
+
+        const std::vector<std::unique_ptr<Stmt>>* statements;
+        size_t next;
+        Kind kind;
+        size_t workBase; // work items below this belong to an outer frame
+        size_t base;     // slot 0 of the function running in this frame
+        size_t bytes;    // CALL: memory charged for the frame
+    };
+    std::vector<Frame> frames;
+
+    // Recursion never ends in a language without conditionals; this turns
+    // it into an error long before memory runs out
+    static constexpr size_t MAX_CALL_DEPTH = 1 << 16;
+
+    // Work and value stacks shared by every frame. A statement pushes the
+    // work to evaluate its expression and then to complete itself; a call
+    // in the middle of an expression pushes a frame, and the caller's work
+    // resumes once it returns.
+    struct Work
+    {
+        enum Kind : uint8_t
+        {
+            VISIT,
+            APPLY_UNARY,   // operand is on the value stack
+            APPLY_BINARY,  // both operands are on the value stack
+            CALL,          // arguments are on the value stack
+            INLINE_RETURN, // an inlined body has been evaluated
+            APPLY_INDEX,   // array and index are on the value stack
+            MAKE_ARRAY,    // elements are on the value stack
+
+            // Statements whose expression has been evaluated
+            ASSIGN,
+            DECLARE,
+            PRINT,
+            DISCARD,
+            RETURN,
+            STORE, // array and index are below the value
+        };
+
+        union
+        {
+            const Expr* expr;
+            const Stmt* stmt;
+        };
+        Kind kind;
+
+        Work(const Expr* e, Kind k) : expr(e), kind(k) {}
+        Work(const Stmt* s, Kind k) : stmt(s), kind(k) {}
+    };
+    std::vector<Work> work;
+    std::vector<Value> values; // call frames and expression temporaries
+    size_t base = 0;           // slot 0 of the running function
+    size_t calls = 0;          // CALL frames on the stack
 
 public:
+    Interpreter()
+        : governor(ownGovernor), strings(governor), arrays(governor)
+    {
+        values.reserve(4096);
+    }
+
+    explicit Interpreter(ResourceGovernor& g)
+        : governor(g), strings(governor), arrays(governor)
+    {
+        values.reserve(4096);
+    }
+
     // Entry point: execute the whole program
+    //
+    // Blocks and calls do not recurse: each is a Frame on an explicit
+    // stack, so nesting and call depth are limited by heap memory only.
     void Execute(const std::vector<std::unique_ptr<Stmt>>& statements)
     {
-      scopes.push_back({}); //global scope
-        for (const auto& stmt : statements)
+        if (scopes.empty())
+            EnterScope(); // global scope, possibly restored from a snapshot
+
+        frames.clear();
+        work.clear();
+        values.clear();
+        base = 0;
+        calls = 0;
+        frames.push_back({&statements, 0, Frame::PROGRAM, 0, 0, 0});
+
+        while (!frames.empty())
         {
-            ExecuteStmt(stmt.get());
+            Frame& frame = frames.back();
+
+            if (work.size() > frame.workBase)
+            {
+                Evaluate(frame.workBase);
+                continue;
+            }
+
+            if (frame.next == frame.statements->size())
+            {
+                EndFrame();
+                continue;
+            }
+
+            ExecuteStmt((*frame.statements)[frame.next++].get());
         }
     }
 
+    // ---------------- SNAPSHOTS ----------------
+
+    // The global scope as left by Execute()
+    const std::unordered_map<std::string, Value>& Globals() const
+    {
+        static const std::unordered_map<std::string, Value> none;
+        return scopes.empty() ? none : scopes.front();
+    }
+
+    // Makes the globals of 'source' visible before Execute(). They are
+    // copied into the global scope one at a time, when first used, so
+    // 'source' must outlive the interpreter; see snapshot.h
+    void RestoreGlobals(GlobalSource& source)
+    {
+        if (scopes.empty())
+            EnterScope();
+        restored = &source;
+    }
+
+    // Copies every restored global not used yet, so Globals() is complete
+    void LoadRestoredGlobals()
+    {
+        if (!restored)
+            return;
+
+        for (std::string_view name : restored->Names())
+            if (!scopes.front().count(std::string(name)))
+                LoadRestored(std::string(name));
+    }
+
+    Value InternString(std::string_view s)
+    {
+        return strings.Intern(s);
+    }
+
 private:
     // ---------------- STATEMENTS ----------------
     void EnterScope()
     {
+        size_t bytes = sizeof(decltype(scopes)::value_type);
+        governor.Charge(bytes);
         scopes.push_back({});
+        scopeBytes.push_back(bytes);
     }
     
     void ExitScope()
     {
+        governor.Release(scopeBytes.back());
+        scopeBytes.pop_back();
         scopes.pop_back();
     }
 
-    double GetVariable(const std::string& name)
+    Value GetVariable(const std::string& name)
     {
       for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
       {
@@ -44,10 +219,12 @@ private:
           if (found != it->end())
               return found->second;
       }
+      if (Value* global = LoadRestored(name))
+          return *global;
       throw std::runtime_error("Undefined variable: " + name);
     }
 
-    void SetVariable(const std::string& name, double value)
+    void SetVariable(const std::string& name, Value value)
     {
         for (auto it = scopes.rbegin(); it != scopes.rend(); ++it)
         {
@@ -59,95 +236,487 @@ private:
             }
         }
 
+        if (Value* global = LoadRestored(name))
+        {
+            *global = value;
+            return;
+        }
+
     throw std::runtime_error("Undefined variable: " + name);
     }
 
 
 
+    Value GetGlobal(const std::string& name)
+    {
+        auto found = scopes.front().find(name);
+        if (found != scopes.front().end())
+            return found->second;
+        if (Value* global = LoadRestored(name))
+            return *global;
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+
+    void SetGlobal(const std::string& name, Value value)
+    {
+        auto found = scopes.front().find(name);
+        if (found != scopes.front().end())
+            found->second = value;
+        else if (Value* global = LoadRestored(name))
+            *global = value;
+        else
+            throw std::runtime_error("Undefined variable: " + name);
+    }
+
+    // Moves restored global 'name' into the global scope. Only called once
+    // the global scope has no 'name' of its own.
+    Value* LoadRestored(const std::string& name)
+    {
+        if (!restored)
+            return nullptr;
+
+        std::optional<Value> value = restored->Load(name, strings);
+        if (!value)
+            return nullptr;
+
+        size_t bytes = EntryBytes(name);
+        governor.Charge(bytes);
+        scopeBytes.front() += bytes;
+
+        return &(scopes.front()[name] = *value);
+    }
+
+    // Starts a statement: blocks open a frame, everything else schedules
+    // its expression followed by its own completion (see Complete)
     void ExecuteStmt(const Stmt* stmt)
     {
+        governor.Step();
+
+        if (auto block = dynamic_cast<const BlockStmt*>(stmt))
+        {
+            Frame::Kind kind = Frame::LOCAL_BLOCK;
+            if (calls == 0)
+            {
+                EnterScope();
+                kind = Frame::BLOCK;
+            }
+            frames.push_back({&block->statements, 0, kind, work.size(), base, 0});
+            return;
+        }
+
         // Assignment: x = expression
         if (auto assign = dynamic_cast<const AssignStmt*>(stmt))
         {
-            double value = EvaluateExpr(assign->value.get());
-            SetVariable(assign->name, value);
+            work.emplace_back(stmt, Work::ASSIGN);
+            work.emplace_back(assign->value.get(), Work::VISIT);
             return;
         }
 
         if (auto varDecl = dynamic_cast<const VarDeclStmt*>(stmt))
         {
-            double value = EvaluateExpr(varDecl->initializer.get());
-            DeclareVariable(varDecl->name, value);
+            work.emplace_back(stmt, Work::DECLARE);
+            work.emplace_back(varDecl->initializer.get(), Work::VISIT);
             return;
         }
 
-
         // Print: print expression
         if (auto print = dynamic_cast<const PrintStmt*>(stmt))
         {
-            double value = EvaluateExpr(print->value.get());
-            std::cout << value << std::endl;
+            work.emplace_back(stmt, Work::PRINT);
+            work.emplace_back(print->value.get(), Work::VISIT);
+            return;
+        }
+
+        // Store: name[index] = expression
+        if (auto store = dynamic_cast<const IndexAssignStmt*>(stmt))
+        {
+            work.emplace_back(stmt, Work::STORE);
+            work.emplace_back(store->value.get(), Work::VISIT);
+            work.emplace_back(store->index.get(), Work::VISIT);
+            work.emplace_back(store->array.get(), Work::VISIT);
             return;
         }
 
-        if(auto block = dynamic_cast<const BlockStmt*>(stmt))
+        if (auto call = dynamic_cast<const ExprStmt*>(stmt))
         {
-          EnterScope();
-            for(const auto& s: block->statements)
-              ExecuteStmt(s.get());
-          ExitScope();
-          return;
+            work.emplace_back(stmt, Work::DISCARD);
+            work.emplace_back(call->expr.get(), Work::VISIT);
+            return;
         }
 
+        if (auto ret = dynamic_cast<const ReturnStmt*>(stmt))
+        {
+            work.emplace_back(stmt, Work::RETURN);
+            work.emplace_back(ret->value.get(), Work::VISIT);
+            return;
+        }
+
+        // Calls were linked to it by the Resolver
+        if (dynamic_cast<const FunctionStmt*>(stmt))
+            return;
+
         throw std::runtime_error("Unknown statement type");
     }
 
-    // ---------------- EXPRESSIONS ----------------
+    // Finishes a statement once its expression's value is on the stack
+    void Complete(const Work& item)
+    {
+        Value value = values.back();
+        values.pop_back();
+
+        switch (item.kind)
+        {
+        case Work::ASSIGN:
+        {
+            auto assign = static_cast<const AssignStmt*>(item.stmt);
+            switch (assign->ref.kind)
+            {
+            case NameRef::SLOT:   values[base + assign->ref.slot] = value; return;
+            case NameRef::GLOBAL: SetGlobal(assign->name, value); return;
+            case NameRef::SCOPES: SetVariable(assign->name, value); return;
+            }
+            return;
+        }
+
+        case Work::DECLARE:
+        {
+            auto varDecl = static_cast<const VarDeclStmt*>(item.stmt);
+            if (varDecl->ref.kind == NameRef::SLOT)
+                values[base + varDecl->ref.slot] = value;
+            else
+                DeclareVariable(varDecl->name, value);
+            return;
+        }
+
+        case Work::PRINT:
+            PrintValue(std::cout, value);
+            std::cout << std::endl;
+            return;
 
-    double EvaluateExpr(const Expr* expr)
+        case Work::DISCARD:
+            return;
+
+        case Work::STORE:
+        {
+            if (!value.IsNumber())
+                throw std::runtime_error("Array elements must be numbers");
+
+            Value index = values.back();
+            values.pop_back();
+            ArrayElement(values.back(), index) = value.AsNumber();
+            values.pop_back();
+            return;
+        }
+
+        case Work::RETURN:
+            // Blocks inside the function end with it
+            while (frames.back().kind != Frame::CALL)
+                frames.pop_back();
+            Return(value);
+            return;
+
+        default:
+            throw std::logic_error("Not a statement completion");
+        }
+    }
+
+    void EndFrame()
     {
-        // Number literal
-        if (auto num = dynamic_cast<const NumberExpr*>(expr))
+        switch (frames.back().kind)
         {
-            return num->value;
+        case Frame::PROGRAM: // the global scope outlives the program
+        case Frame::LOCAL_BLOCK:
+            frames.pop_back();
+            return;
+
+        case Frame::BLOCK:
+            frames.pop_back();
+            ExitScope();
+            return;
+
+        case Frame::CALL: // no return statement: the call yields 0
+            Return(Value::Number(0));
+            return;
         }
+    }
+
+    // ---------------- CALLS ----------------
 
-        // Variable reference
-        if (auto var = dynamic_cast<const VariableExpr*>(expr))
+    // The arguments on top of the value stack become the first slots of
+    // the callee's frame. Returns false for an inlined call, which is
+    // evaluated as part of the caller's expression.
+    bool Call(const CallExpr* call)
+    {
+        if (call->builtin != Builtin::NONE)
         {
-          return GetVariable(var->name);
+            values.back() = CallBuiltin(*call, values.back());
+            return false;
         }
 
-        // Binary operation
-        if (auto bin = dynamic_cast<const BinaryExpr*>(expr))
+        const FunctionStmt* fn = call->function;
+        size_t args = values.size() - fn->params.size();
+
+        if (call->inlined)
         {
-            double left  = EvaluateExpr(bin->left.get());
-            double right = EvaluateExpr(bin->right.get());
+            governor.Step(); // the return statement it stands for
+            base = args;
+            work.emplace_back(call, Work::INLINE_RETURN);
+            work.emplace_back(call->inlined.get(), Work::VISIT);
+            return false;
+        }
+
+        if (calls == MAX_CALL_DEPTH)
+            throw std::runtime_error("Call stack overflow in " + fn->name);
 
-            switch (bin->op)
+        size_t bytes = sizeof(Frame) + fn->slots * sizeof(Value);
+        governor.Charge(bytes);
+        values.resize(args + fn->slots);
+        frames.push_back({&fn->body, 0, Frame::CALL, work.size(), args, bytes});
+        base = args;
+        calls++;
+        return true;
+    }
+
+    // Pops the CALL frame on top and hands 'result' to the caller
+    void Return(Value result)
+    {
+        governor.Release(frames.back().bytes);
+        calls--;
+        frames.pop_back();
+
+        values.resize(base);
+        values.push_back(result);
+        base = frames.back().base;
+    }
+
+    // All builtins take one argument and work on arrays
+    Value CallBuiltin(const CallExpr& call, Value arg)
+    {
+        if (call.builtin == Builtin::ARRAY || call.builtin == Builtin::RANGE)
+        {
+            double n = arg.IsNumber() ? arg.AsNumber() : -1;
+            if (!(n >= 0 && n <= static_cast<double>(Array::MAX_SIZE)) || n != std::trunc(n))
+                throw std::runtime_error("Argument of " + call.callee +
+                                         " must be a whole number from 0 to " +
+                                         std::to_string(Array::MAX_SIZE));
+
+            Array& array = arrays.Allocate(static_cast<size_t>(n));
+            double* data = array.Data();
+            for (size_t i = 0; i < array.Size(); ++i)
+                data[i] = call.builtin == Builtin::RANGE ? static_cast<double>(i) : 0;
+            return Value::Array(&array);
+        }
+
+        if (!arg.IsArray())
+            throw std::runtime_error("Argument of " + call.callee + " must be an array");
+
+        const Array& array = arg.AsArray();
+        const ArrayKernels& kernels = ArrayKernels::Get();
+
+        switch (call.builtin)
+        {
+        case Builtin::LEN:
+            return Value::Number(static_cast<double>(array.Size()));
+
+        case Builtin::SUM:
+            return Value::Number(kernels.sum(array.Data(), array.Size()));
+
+        case Builtin::MIN:
+        case Builtin::MAX:
+            if (array.Size() == 0)
+                throw std::runtime_error("Argument of " + call.callee + " must not be empty");
+            return Value::Number(call.builtin == Builtin::MIN
+                                     ? kernels.min(array.Data(), array.Size())
+                                     : kernels.max(array.Data(), array.Size()));
+
+        default:
+            throw std::logic_error("Unknown builtin");
+        }
+    }
+
+    // ---------------- EXPRESSIONS ----------------
+
+    // Post-order walk over the shared work stack; values of finished
+    // subtrees wait on the value stack until their parent is applied.
+    // Returns when the frame's work is done or a call or return changed
+    // the frame stack.
+    void Evaluate(size_t workBase)
+    {
+        while (work.size() > workBase)
+        {
+            Work item = work.back();
+            work.pop_back();
+
+            // Binary operation, both operands evaluated
+            if (item.kind == Work::APPLY_BINARY)
             {
-            case '+': return left + right;
-            case '-': return left - right;
-            case '*': return left * right;
-            case '/': return left / right;
-            default:
-                throw std::runtime_error("Unknown binary operator");
+                auto bin = static_cast<const BinaryExpr*>(item.expr);
+                Value right = values.back();
+                values.pop_back();
+                values.back() = ApplyBinary(bin->op, values.back(), right, strings);
+                continue;
             }
-        }
 
-        throw std::runtime_error("Unknown expression type");
+            // Unary operation, operand evaluated
+            if (item.kind == Work::APPLY_UNARY)
+            {
+                auto unary = static_cast<const UnaryExpr*>(item.expr);
+                values.back() = ApplyUnary(unary->op, values.back());
+                continue;
+            }
+
+            if (item.kind == Work::CALL)
+            {
+                if (Call(static_cast<const CallExpr*>(item.expr)))
+                    return;
+                continue;
+            }
+
+            // The arguments make way for the inlined body's value. The body
+            // ran in the caller's frame without pushing one, so that frame
+            // holds the caller's base, however calls are nested.
+            if (item.kind == Work::INLINE_RETURN)
+            {
+                Value result = values.back();
+                values.resize(base);
+                values.push_back(result);
+                base = frames.back().base;
+                continue;
+            }
+
+            if (item.kind == Work::APPLY_INDEX)
+            {
+                Value index = values.back();
+                values.pop_back();
+                values.back() = Value::Number(ArrayElement(values.back(), index));
+                continue;
+            }
+
+            if (item.kind == Work::MAKE_ARRAY)
+            {
+                auto literal = static_cast<const ArrayExpr*>(item.expr);
+                size_t first = values.size() - literal->elements.size();
+
+                Array& array = arrays.Allocate(literal->elements.size());
+                for (size_t i = 0; i < array.Size(); ++i)
+                {
+                    Value element = values[first + i];
+                    if (!element.IsNumber())
+                        throw std::runtime_error("Array elements must be numbers");
+                    array.Data()[i] = element.AsNumber();
+                }
+
+                values.resize(first);
+                values.push_back(Value::Array(&array));
+                continue;
+            }
+
+            if (item.kind != Work::VISIT)
+            {
+                Complete(item);
+                if (item.kind == Work::RETURN)
+                    return;
+                continue;
+            }
+
+            governor.Step();
+
+            // Number literal
+            if (auto num = dynamic_cast<const NumberExpr*>(item.expr))
+            {
+                values.push_back(Value::Number(num->value));
+                continue;
+            }
+
+            // Variable reference
+            if (auto var = dynamic_cast<const VariableExpr*>(item.expr))
+            {
+                Value value;
+                switch (var->ref.kind)
+                {
+                case NameRef::SLOT:   value = values[base + var->ref.slot]; break;
+                case NameRef::GLOBAL: value = GetGlobal(var->name); break;
+                case NameRef::SCOPES: value = GetVariable(var->name); break;
+                }
+                values.push_back(value);
+                continue;
+            }
+
+            // Binary operation: left is evaluated first
+            if (auto bin = dynamic_cast<const BinaryExpr*>(item.expr))
+            {
+                work.emplace_back(bin, Work::APPLY_BINARY);
+                work.emplace_back(bin->right.get(), Work::VISIT);
+                work.emplace_back(bin->left.get(), Work::VISIT);
+                continue;
+            }
+
+            if (auto unary = dynamic_cast<const UnaryExpr*>(item.expr))
+            {
+                work.emplace_back(unary, Work::APPLY_UNARY);
+                work.emplace_back(unary->operand.get(), Work::VISIT);
+                continue;
+            }
+
+            // String literal, tested late to keep the numeric path short
+            if (auto str = dynamic_cast<const StringExpr*>(item.expr))
+            {
+                values.push_back(strings.Intern(str->value));
+                continue;
+            }
+
+            // Call: arguments are evaluated left to right
+            if (auto call = dynamic_cast<const CallExpr*>(item.expr))
+            {
+                work.emplace_back(call, Work::CALL);
+                for (size_t i = call->args.size(); i-- > 0;)
+                    work.emplace_back(call->args[i].get(), Work::VISIT);
+                continue;
+            }
+
+            // Indexing: the array, then the index
+            if (auto index = dynamic_cast<const IndexExpr*>(item.expr))
+            {
+                work.emplace_back(index, Work::APPLY_INDEX);
+                work.emplace_back(index->index.get(), Work::VISIT);
+                work.emplace_back(index->array.get(), Work::VISIT);
+                continue;
+            }
+
+            // Array literal: elements are evaluated left to right
+            if (auto literal = dynamic_cast<const ArrayExpr*>(item.expr))
+            {
+                work.emplace_back(literal, Work::MAKE_ARRAY);
+                for (size_t i = literal->elements.size(); i-- > 0;)
+                    work.emplace_back(literal->elements[i].get(), Work::VISIT);
+                continue;
+            }
+
+            throw std::runtime_error("Unknown expression type");
+        }
     }
 
-    void DeclareVariable(const std::string& name, double value)
+    void DeclareVariable(const std::string& name, Value value)
     {
         auto& scope = scopes.back();
     
-        if (scope.count(name))
+        // A restored global counts as declared in the global scope
+        if (scope.count(name) || (scopes.size() == 1 && LoadRestored(name)))
             throw std::runtime_error("Variable already declared in this scope: " + name);
-    
+
+        size_t bytes = EntryBytes(name);
+        governor.Charge(bytes);
+        scopeBytes.back() += bytes;
+
         scope[name] = value;
     }
 
+    // Rough cost of one hash node: key, value, next pointer and bucket
+    static size_t EntryBytes(const std::string& name)
+    {
+        return sizeof(std::pair<const std::string, Value>) + 2 * sizeof(void*) + name.size();
+    }
+
 
 };
 
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "token.h"
+
+// ---------- Integer range inference ----------
+//
+// Static types for the integer fast path of the compiled tiers. An
+// expression is 'integral' when it is proven to evaluate to an exact
+// integer in [lo, hi] *and* double arithmetic would produce that same
+// integer. Such expressions can run on int64 without changing any printed
+// output.
+//
+// Two things break the equivalence, and the rules below avoid both:
+//   - magnitudes above 2^53, where doubles stop being exact;
+//   - -0, which doubles produce (0 * -1, -(0)) and print as "-0".
+// Division is never integral.
+struct IntRange
+{
+    // Every integer with magnitude up to 2^53 is exactly representable
+    static constexpr int64_t LIMIT = int64_t(1) << 53;
+
+    bool integral = false;
+    int64_t lo = 0;
+    int64_t hi = 0;
+
+    // Unknown() when [lo, hi] leaves the exact range
+    static IntRange Of(__int128 lo, __int128 hi)
+    {
+        if (lo < -LIMIT || hi > LIMIT)
+            return Unknown();
+        return {true, static_cast<int64_t>(lo), static_cast<int64_t>(hi)};
+    }
+
+    static IntRange Unknown()
+    {
+        return {};
+    }
+
+    bool Contains(int64_t v) const
+    {
+        return lo <= v && v <= hi;
+    }
+};
+
+inline IntRange InferNumber(double v)
+{
+    if (!(std::fabs(v) <= IntRange::LIMIT) || v != std::trunc(v))
+        return IntRange::Unknown();
+
+    auto i = static_cast<int64_t>(v);
+    return IntRange::Of(i, i);
+}
+
+inline IntRange InferUnary(TokenType op, IntRange a)
+{
+    // -(0) is -0
+    if (op != TokenType::MINUS || !a.integral || a.Contains(0))
+        return IntRange::Unknown();
+
+    return IntRange::Of(-static_cast<__int128>(a.hi), -static_cast<__int128>(a.lo));
+}
+
+inline IntRange InferBinary(TokenType op, IntRange a, IntRange b)
+{
+    if (!a.integral || !b.integral)
+        return IntRange::Unknown();
+
+    using Wide = __int128;
+
+    switch (op)
+    {
+    case TokenType::PLUS:
+        return IntRange::Of(Wide(a.lo) + b.lo, Wide(a.hi) + b.hi);
+
+    case TokenType::MINUS:
+        return IntRange::Of(Wide(a.lo) - b.hi, Wide(a.hi) - b.lo);
+
+    case TokenType::STAR:
+    {
+        // 0 times a negative number is -0
+        if ((a.Contains(0) && b.lo < 0) || (b.Contains(0) && a.lo < 0))
+            return IntRange::Unknown();
+
+        Wide p[] = {Wide(a.lo) * b.lo, Wide(a.lo) * b.hi,
+                    Wide(a.hi) * b.lo, Wide(a.hi) * b.hi};
+        Wide lo = p[0], hi = p[0];
+        for (Wide x : p)
+        {
+            lo = x < lo ? x : lo;
+            hi = x > hi ? x : hi;
+        }
+        return IntRange::Of(lo, hi);
+    }
+
+    // Comparisons of exact integers agree with double comparisons
+    case TokenType::EQUAL_EQUAL:
+    case TokenType::NOT_EQUAL:
+    case TokenType::LESS:
+    case TokenType::LESS_EQUAL:
+    case TokenType::GREATER:
+    case TokenType::GREATER_EQUAL:
+        return IntRange::Of(0, 1);
+
+    default:
+        return IntRange::Unknown();
+    }
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "token.h"
+#include "governor.h"
+#include "array.h"
+
+// ---------- Value ----------
+
+// A 64-bit NaN-boxed value.
+//
+// Numbers are stored as the raw bits of their double, so arithmetic on
+// numbers never touches a tag. Every other type lives in the payload of a
+// quiet NaN with the sign bit set:
+//
+//   1 11111111111 11 tt pppp...p   (tt = type tag, p = 48-bit pointer)
+//
+// The NaNs produced by arithmetic (0x7ff8... and 0xfff8...) have bit 50
+// clear, so they can never be mistaken for a boxed value and are printed
+// exactly as before.
+class Value
+{
+public:
+    Value()
+        : bits(0) // the number 0
+    {
+    }
+
+    static Value Number(double d)
+    {
+        Value v;
+        std::memcpy(&v.bits, &d, sizeof(d));
+        return v;
+    }
+
+    // 's' must stay alive as long as the value; see StringTable
+    static Value String(const std::string* s)
+    {
+        Value v;
+        v.bits = BOXED | TAG_STRING | reinterpret_cast<uintptr_t>(s);
+        return v;
+    }
+
+    // 'a' must stay alive as long as the value; see ArrayHeap
+    static Value Array(::Array* a)
+    {
+        Value v;
+        v.bits = BOXED | TAG_ARRAY | reinterpret_cast<uintptr_t>(a);
+        return v;
+    }
+
+    bool IsNumber() const
+    {
+        return (bits & BOXED) != BOXED;
+    }
+
+    bool IsString() const
+    {
+        return (bits & (BOXED | TAG_MASK)) == (BOXED | TAG_STRING);
+    }
+
+    bool IsArray() const
+    {
+        return (bits & (BOXED | TAG_MASK)) == (BOXED | TAG_ARRAY);
+    }
+
+    double AsNumber() const
+    {
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    const std::string& AsString() const
+    {
+        return *reinterpret_cast<const std::string*>(bits & PAYLOAD);
+    }
+
+    // Arrays are shared: every value referring to one sees its stores
+    ::Array& AsArray() const
+    {
+        return *reinterpret_cast<::Array*>(bits & PAYLOAD);
+    }
+
+    uint64_t Bits() const
+    {
+        return bits;
+    }
+
+private:
+    static constexpr uint64_t BOXED = 0xfffc000000000000; // sign + exponent + quiet + bit 50
+    static constexpr uint64_t TAG_MASK = 0x0003000000000000;
+    static constexpr uint64_t TAG_STRING = 0x0001000000000000;
+    static constexpr uint64_t TAG_ARRAY = 0x0002000000000000;
+    static constexpr uint64_t PAYLOAD = 0x0000ffffffffffff;
+
+    uint64_t bits;
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay one machine word");
+
+// ---------- Strings ----------
+
+// Owns every string a program creates. Equal strings are stored once, so
+// string equality is pointer equality, and the node-based set keeps each
+// string at a stable address for the whole run.
+class StringTable
+{
+private:
+    std::unordered_set<std::string> strings;
+
+    ResourceGovernor ownGovernor;
+    ResourceGovernor& governor; // charged for every new string
+
+public:
+    StringTable()
+        : governor(ownGovernor)
+    {
+    }
+
+    explicit StringTable(ResourceGovernor& g)
+        : governor(g)
+    {
+    }
+
+    Value Intern(std::string_view s)
+    {
+        auto [it, added] = strings.emplace(s);
+        if (added)
+            governor.Charge(sizeof(std::string) + 2 * sizeof(void*) + it->size());
+        return Value::String(&*it);
+    }
+};
+
+// ---------- Operators ----------
+//
+// ConstantEvaluator (compiletime.h) has its own constexpr copy of these
+// rules and of number printing; run tests/compiletime.cpp after changing
+// them.
+
+// Printed form of a value, as used by 'print' and string concatenation
+inline void PrintValue(std::ostream& out, Value v)
+{
+    if (v.IsNumber())
+    {
+        out << v.AsNumber();
+    }
+    else if (v.IsArray())
+    {
+        const Array& array = v.AsArray();
+        out << '[';
+        for (size_t i = 0; i < array.Size(); ++i)
+            out << (i > 0 ? ", " : "") << array.Data()[i];
+        out << ']';
+    }
+    else
+    {
+        out << v.AsString();
+    }
+}
+
+constexpr double NumberBinary(TokenType op, double left, double right)
+{
+    switch (op)
+    {
+    case TokenType::PLUS:          return left + right;
+    case TokenType::MINUS:         return left - right;
+    case TokenType::STAR:          return left * right;
+    case TokenType::SLASH:         return left / right;
+
+    // Comparisons yield 1 (true) or 0 (false)
+    case TokenType::EQUAL_EQUAL:   return left == right;
+    case TokenType::NOT_EQUAL:     return left != right;
+    case TokenType::LESS:          return left < right;
+    case TokenType::LESS_EQUAL:    return left <= right;
+    case TokenType::GREATER:       return left > right;
+    case TokenType::GREATER_EQUAL: return left >= right;
+    default:
+        throw std::runtime_error("Unknown binary operator");
+    }
+}
+
+// + - * / with an array operand and an array or number operand: one new
+// array, computed by the kernels (see array.h)
+inline Value ArrayBinary(TokenType op, Value left, Value right)
+{
+    if (left.IsString() || right.IsString())
+        throw std::runtime_error("Operands must be numbers");
+
+    // The kernels read a number operand through a pointer
+    double leftNumber = left.IsNumber() ? left.AsNumber() : 0;
+    double rightNumber = right.IsNumber() ? right.AsNumber() : 0;
+    const double* a = left.IsArray() ? left.AsArray().Data() : &leftNumber;
+    const double* b = right.IsArray() ? right.AsArray().Data() : &rightNumber;
+
+    ArrayShape shape = ArrayShape::ARRAYS;
+    if (!left.IsArray())
+        shape = ArrayShape::LEFT_NUMBER;
+    else if (!right.IsArray())
+        shape = ArrayShape::RIGHT_NUMBER;
+    else if (left.AsArray().Size() != right.AsArray().Size())
+        throw std::runtime_error("Array lengths differ: " + std::to_string(left.AsArray().Size()) +
+                                 " and " + std::to_string(right.AsArray().Size()));
+
+    const Array& operand = left.IsArray() ? left.AsArray() : right.AsArray();
+    Array& result = operand.Heap().Allocate(operand.Size());
+    ArrayKernels::Get().map[ArrayKernels::Row(op)][static_cast<size_t>(shape)](
+        a, b, result.Data(), operand.Size());
+    return Value::Array(&result);
+}
+
+// Operators with at least one non-number operand:
+//   string + any, any + string   concatenation of the printed forms
+//   array + - * / array/number   element-wise, see ArrayBinary
+//   == !=                        identity (strings are interned)
+//   < <= > >=                    lexicographic, strings only
+inline Value MixedBinary(TokenType op, Value left, Value right, StringTable& strings)
+{
+    switch (op)
+    {
+    case TokenType::PLUS:
+    {
+        if (!left.IsString() && !right.IsString())
+            return ArrayBinary(op, left, right);
+
+        std::ostringstream text;
+        PrintValue(text, left);
+        PrintValue(text, right);
+        return strings.Intern(text.str());
+    }
+
+    case TokenType::MINUS:
+    case TokenType::STAR:
+    case TokenType::SLASH:
+        return ArrayBinary(op, left, right);
+
+    case TokenType::EQUAL_EQUAL:
+        return Value::Number(left.Bits() == right.Bits());
+    case TokenType::NOT_EQUAL:
+        return Value::Number(left.Bits() != right.Bits());
+
+    case TokenType::LESS:
+    case TokenType::LESS_EQUAL:
+    case TokenType::GREATER:
+    case TokenType::GREATER_EQUAL:
+    {
+        if (!left.IsString() || !right.IsString())
+            throw std::runtime_error("Operands must be two numbers or two strings");
+
+        int c = left.AsString().compare(right.AsString());
+        return Value::Number(NumberBinary(op, c, 0));
+    }
+
+    default:
+        throw std::runtime_error("Operands must be numbers");
+    }
+}
+
+// The element 'array[index]' refers to, for reading or storing
+inline double& ArrayElement(Value array, Value index)
+{
+    if (!array.IsArray())
+        throw std::runtime_error("Only arrays can be indexed");
+    if (!index.IsNumber())
+        throw std::runtime_error("Array index must be a number");
+
+    Array& elements = array.AsArray();
+    double i = index.AsNumber();
+    if (!(i >= 0 && i < static_cast<double>(elements.Size())) || i != std::trunc(i))
+    {
+        std::ostringstream message;
+        if (i != std::trunc(i))
+            message << "Array index must be a whole number: " << i;
+        else
+            message << "Array index out of range: " << i << " (length " << elements.Size() << ")";
+        throw std::runtime_error(message.str());
+    }
+    return elements.Data()[static_cast<size_t>(i)];
+}
+
+inline Value ApplyBinary(TokenType op, Value left, Value right, StringTable& strings)
+{
+    // Numeric fast path: two tag tests, then plain double arithmetic
+    if (left.IsNumber() && right.IsNumber())
+        return Value::Number(NumberBinary(op, left.AsNumber(), right.AsNumber()));
+
+    return MixedBinary(op, left, right, strings);
+}
+
+inline Value ApplyUnary(TokenType op, Value operand)
+{
+    if (operand.IsArray() && op == TokenType::MINUS)
+    {
+        const Array& array = operand.AsArray();
+        Array& result = array.Heap().Allocate(array.Size());
+        ArrayKernels::Get().negate(array.Data(), result.Data(), array.Size());
+        return Value::Array(&result);
+    }
+
+    if (!operand.IsNumber())
+        throw std::runtime_error("Operand must be a number");
+
+    switch (op)
+    {
+    case TokenType::MINUS: return Value::Number(-operand.AsNumber());
+    default:
+        throw std::runtime_error("Unknown unary operator");
+    }
+}